@@ -0,0 +1,57 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <memory>
+
+#include "emulator.hpp"
+
+using namespace std;
+
+// Runs hex images headless on a pool of threads, each task has its own Emulator and tasks are stolen
+// from the other workers' queues once a worker runs out of its own
+class BatchRunner {
+public:
+  struct batchResult {
+    string image;
+    string output;
+    double seconds;
+  };
+
+private:
+  struct workQueue {
+    mutex lock;
+    deque<size_t> tasks;
+  };
+
+  // every image is loaded once into a checkpoint in memory, the runs map it privately and share its pages until they write
+  struct sharedImage {
+    once_flag loaded;
+    bool valid = false;
+    int fd = -1;
+    string checkpoint;
+    string error;
+  };
+
+  emulatorOptions options;
+  vector<batchResult> results;
+  vector<unique_ptr<workQueue>> queues;
+  map<string, unique_ptr<sharedImage>> images;
+
+  bool take(size_t, size_t &);
+  void worker(size_t);
+  void load(const string &, sharedImage &);
+
+public:
+  BatchRunner(const vector<string> &, emulatorOptions);
+  ~BatchRunner();
+
+  void run(unsigned);
+  const vector<batchResult> &getResults() const { return results; }
+};
+
+#endif // BATCH_H
@@ -0,0 +1,109 @@
+#ifndef CACHE_MODEL_H
+#define CACHE_MODEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+
+#include "memory.hpp"
+
+using namespace std;
+
+// sizes in bytes, no cache when size is 0
+struct cacheGeometry {
+  uint32_t size = 0;
+  uint32_t line = 0;
+  uint32_t ways = 0;
+};
+
+// One set-associative cache with LRU replacement, stores allocate a line and dirty lines are written back
+// when they are replaced; only the tags are kept, the data stays in Memory
+class Cache {
+private:
+  struct way {
+    uint32_t line;
+    bool valid;
+    bool dirty;
+    uint64_t lastUse;
+  };
+
+  uint32_t lineBits;
+  uint32_t setMask;
+  uint32_t ways;
+  vector<way> sets;
+  uint64_t clock = 0;
+
+  bool accessLine(uint32_t, bool);
+
+public:
+  const cacheGeometry geometry;
+  uint64_t accesses = 0;
+  uint64_t writes = 0;
+  uint64_t misses = 0;
+  uint64_t writebacks = 0;
+
+  Cache(const cacheGeometry &);
+
+  // a power of two line of at least a word and a power of two number of sets
+  static bool valid(const cacheGeometry &);
+
+  // a word that spans two lines misses when either of them does
+  bool access(uint32_t address, bool write) {
+    accesses++;
+    if(write) writes++;
+    bool hit = accessLine(address >> lineBits, write);
+    if(((address + 3) >> lineBits) != (address >> lineBits)) hit = accessLine((address + 3) >> lineBits, write) && hit;
+    if(!hit) misses++;
+    return hit;
+  }
+};
+
+// The I-cache sees every fetch and the D-cache every load and store of the guest outside of the devices,
+// the data accesses belong to the pc of the last fetch; DMA transfers go around both
+class CacheModel {
+public:
+  static const uint32_t REGION_BITS = 12;
+
+private:
+  struct counts {
+    uint64_t accesses = 0;
+    uint64_t misses = 0;
+  };
+
+  unique_ptr<Cache> instructionCache;
+  unique_ptr<Cache> dataCache;
+  uint32_t pc = 0;
+
+  unordered_map<uint32_t, counts> fetchesByPc;
+  unordered_map<uint32_t, counts> dataByPc;
+  unordered_map<uint32_t, counts> dataByRegion;
+
+public:
+  CacheModel(const cacheGeometry &, const cacheGeometry &);
+
+  void fetch(uint32_t address) {
+    pc = address;
+    if(!instructionCache) return;
+    counts &byPc = fetchesByPc[address];
+    byPc.accesses++;
+    if(!instructionCache->access(address, false)) byPc.misses++;
+  }
+
+  void data(uint32_t address, bool write) {
+    if(!dataCache) return;
+    counts &byPc = dataByPc[pc];
+    counts &byRegion = dataByRegion[address >> REGION_BITS];
+    byPc.accesses++;
+    byRegion.accesses++;
+    if(dataCache->access(address, write)) return;
+    byPc.misses++;
+    byRegion.misses++;
+  }
+
+  bool write(const string &, const Memory &);
+};
+
+#endif // CACHE_MODEL_H
@@ -0,0 +1,95 @@
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <set>
+
+using namespace std;
+
+// Direct mapped cache of decoded instructions, tagged with the guest pc
+class DecodeCache {
+public:
+  // op is OC << 4 | MOD, encodings that the processor doesn't know are decoded as UNKNOWN;
+  // the ops from 0xA0 are the literal idioms of the assembler fused into one entry with the literal in D,
+  // the ops from 0xB0 are special cases of an encoding that insert gives their own handler
+  enum opId {
+    HALT = 0x00, INT = 0x10,
+    LD_LITERAL = 0xA0, LD_MEMORY_LITERAL = 0xA1, ST_MEMORY_LITERAL = 0xA2, JMP_LITERAL = 0xA3, CALL_LITERAL = 0xA4,
+    BEQ_LITERAL = 0xA5, BNE_LITERAL = 0xA6, BGT_LITERAL = 0xA7,
+    NOP = 0xB0, LD_PC = 0xB2, LD_PC_POST = 0xB3, BREAKPOINT = 0xB4,
+    UNKNOWN = 0xFF
+  };
+  static const uint32_t FUSED_OPS = 8;
+
+  struct decodedInstruction {
+    uint32_t pc;
+    int32_t D;
+    uint8_t op;
+    uint8_t A;
+    uint8_t B;
+    uint8_t C;
+    bool valid;
+    // bytes of guest code the entry was decoded from
+    uint8_t size;
+    // OC of the encoding, op may be a special case of it or a fused idiom
+    uint8_t OC;
+  };
+
+private:
+  static const uint32_t CACHE_BITS = 16;
+  static const uint32_t CACHE_MASK = (1 << CACHE_BITS) - 1;
+  static const uint32_t PAGE_BITS = 12;
+
+  vector<decodedInstruction> entries;
+
+  // pcs where the debugger stops, insert gives them the BREAKPOINT op so that the fetch never compares addresses
+  set<uint32_t> breakpoints;
+
+  // pages that have decoded instructions and the cache slots filled from them
+  vector<bool> codePages;
+  map<uint32_t, vector<uint32_t>> pageSlots;
+
+  void invalidatePage(uint32_t);
+
+public:
+  DecodeCache();
+
+  static decodedInstruction decode(uint32_t, uint32_t);
+  static decodedInstruction specialize(decodedInstruction);
+
+  decodedInstruction *find(uint32_t pc) {
+    decodedInstruction *entry = &entries[(pc >> 2) & CACHE_MASK];
+    if(entry->valid && entry->pc == pc) return entry;
+    return nullptr;
+  }
+
+  decodedInstruction *insert(uint32_t, uint32_t);
+
+  // first instructions of the idioms, the words after them are only read for these
+  static bool fusable(const decodedInstruction *entry) {
+    return (entry->op == 0x92 && entry->B == 15 && entry->C == 0) || entry->op == 0x82 || entry->op == 0x38 || entry->op == 0x21 ||
+           (entry->op >= 0x39 && entry->op <= 0x3B);
+  }
+  bool fuse(decodedInstruction *, const uint32_t *);
+
+  // called on every guest store, the common case is a single bit test
+  void invalidate(uint32_t address) {
+    if(codePages[address >> PAGE_BITS]) invalidatePage(address >> PAGE_BITS);
+    if(codePages[(address + 3) >> PAGE_BITS]) invalidatePage((address + 3) >> PAGE_BITS);
+  }
+
+  void invalidateRange(uint32_t, size_t);
+
+  static uint32_t lastPage(const decodedInstruction &entry) { return (entry.pc + entry.size - 1) >> PAGE_BITS; }
+
+  // the entry of the pc is dropped, the next fetch inserts it again with or without the breakpoint
+  void setBreakpoint(uint32_t, bool);
+  void clearBreakpoints();
+
+  void clear();
+  vector<uint32_t> pages() const;
+};
+
+#endif // DECODE_CACHE_H
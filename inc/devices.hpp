@@ -0,0 +1,45 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+using namespace std;
+
+// Address ranges of the memory mapped devices, a guest access that touches a range goes to its callbacks instead of memory;
+// regions are added before the run and are not changed while it is running
+class DeviceRegistry {
+public:
+  // the callbacks get the address and the word of the access, also when only some of its bytes are in the range,
+  // a region without a read callback is read from memory
+  typedef function<uint32_t(uint32_t)> readCallback;
+  typedef function<void(uint32_t, uint32_t)> writeCallback;
+
+  struct deviceRegion {
+    string name;
+    uint32_t start;
+    uint32_t end;
+    readCallback read;
+    writeCallback write;
+  };
+
+private:
+  vector<deviceRegion> regions;
+  // lowest address of a word access that can touch a region, the only check on accesses to memory
+  uint32_t firstAccess = UINT32_MAX;
+  uint32_t firstRegionAccess = UINT32_MAX;
+
+public:
+  bool add(const string &, uint32_t, uint32_t, readCallback, writeCallback);
+
+  bool mayHit(uint32_t address) const { return address >= firstAccess; }
+  // the watchpoints of a debugger send the accesses from their first one down the same path, UINT32_MAX when there are none
+  void watchFrom(uint32_t address) { firstAccess = min(firstRegionAccess, address); }
+  const deviceRegion *find(uint32_t) const;
+  const vector<deviceRegion> &getRegions() const { return regions; }
+};
+
+#endif // DEVICES_H
@@ -0,0 +1,75 @@
+#ifndef EMBEDDED_EMULATOR_H
+#define EMBEDDED_EMULATOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <functional>
+#include <memory>
+
+#include "emulator.hpp"
+
+using namespace std;
+
+// Emulator for a host program that links libemulator: the image comes from a buffer, runs are bounded and the
+// state is read and written between them; no thread is started and stdin is not read unless the options ask for it
+class EmbeddedEmulator {
+public:
+  enum runResult { HALTED, BUDGET_USED, CONDITION_MET, IDLE };
+
+private:
+  unique_ptr<Emulator> emulator;
+  bool started = false;
+
+  void begin(uint64_t);
+  runResult finish(bool);
+
+public:
+  // headless with the timer in virtual time, the defaults of the constructor
+  static emulatorOptions defaultOptions();
+
+  EmbeddedEmulator(emulatorOptions = defaultOptions());
+
+  bool loadHex(const char *, size_t);
+  bool loadHex(const string &image) { return loadHex(image.data(), image.size()); }
+  bool loadCheckpoint(const string &);
+  bool saveCheckpoint(const string &fileName) { return emulator->saveCheckpoint(fileName); }
+
+  // at most that many instructions, maxInstructions of the options is a limit for all runs together
+  runResult run(uint64_t);
+  // the condition is checked after every instruction, the run is interpreted whatever the engine
+  runResult runUntil(const function<bool(EmbeddedEmulator &)> &, uint64_t);
+
+  bool halted() const { return emulator->halted; }
+  uint64_t instructions() const { return emulator->instructionCount; }
+
+  // 0 for an index past the last register
+  uint32_t gpr(int index) const { return index >= 0 && index < 16 ? emulator->gprs[index] : 0; }
+  // false for r0, which is always zero, and for an index past the last register
+  bool setGpr(int, uint32_t);
+  uint32_t pc() const { return emulator->gprs[15]; }
+  void setPc(uint32_t value) { setGpr(15, value); }
+  uint32_t csr(int index) const { return index >= 0 && index < 16 ? emulator->csrs[index] : 0; }
+  // false for coreid, which belongs to the machine, and for an index past the last csr
+  bool setCsr(int, uint32_t);
+
+  uint32_t read32(uint32_t address) const { return emulator->memory.read32(address); }
+  void read(uint32_t, void *, size_t) const;
+  void write32(uint32_t address, uint32_t value) { write(address, &value, sizeof(value)); }
+  void write(uint32_t, const void *, size_t);
+
+  // a device of the host at [start, end], false if the range overlaps another device
+  bool addDevice(const string &name, uint32_t start, uint32_t end, DeviceRegistry::readCallback read, DeviceRegistry::writeCallback write) {
+    return emulator->devices.add(name, start, end, read, write);
+  }
+
+  // device events, taken by the guest like those of the device threads
+  size_t typeInput(const string &chars) { return emulator->terminalInput(chars.data(), chars.size()); }
+  void timerTick() { emulator->postInterrupt(Emulator::TIMER_INTERRUPT); }
+
+  // what the guest wrote to TERM_OUT
+  string output() const { return emulator->output(); }
+  void clearOutput() { emulator->captured.str(""); }
+};
+
+#endif // EMBEDDED_EMULATOR_H
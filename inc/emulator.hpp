@@ -3,25 +3,157 @@
 
 #include <string>
 #include <vector>
-#include <map>
+#include <iostream>
+#include <sstream>
 #include <atomic>
 #include <thread>
-#include <semaphore.h>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <chrono>
+#include <termios.h>
+
+#include "memory.hpp"
+#include "decodeCache.hpp"
+#include "jit.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+#include "devices.hpp"
+#include "gdbStub.hpp"
+#include "cacheModel.hpp"
 
 using namespace std;
 
+enum engineType { SWITCH_ENGINE, THREADED_ENGINE, JIT_ENGINE };
+
+struct emulatorOptions {
+  engineType engine = SWITCH_ENGINE;
+  bool mips = false;
+  // resident guest memory and its touched pages by region, printed at the end of the run
+  bool footprint = false;
+  // the timer counts retired instructions instead of wall clock milliseconds
+  bool virtualTime = false;
+  uint64_t instructionsPerMs = 10000;
+  // prefix of the profile files, no profiling when empty
+  string profile;
+  // binary trace of the run, other cores add their number to the name, no trace when empty
+  string trace;
+  // JSON report of the guest counters written at the end of the run and on SIGUSR1, none when empty;
+  // memory accesses and the opcode mix are only counted with it
+  string stats;
+  // gdb connects to a port on localhost or to a Unix socket at this path before the run, which starts stopped;
+  // no debugger when empty
+  string gdb;
+  // checkpoint written once saveAt instructions have been retired
+  string saveFile;
+  uint64_t saveAt = UINT64_MAX;
+  // checkpoint loaded instead of the hex image
+  string restoreFile;
+  // caches modeled on the fetches and on the loads and stores, a size of 0 leaves one out; the hits and misses
+  // by pc and by data region go to cacheReport at the end of the run
+  cacheGeometry icache;
+  cacheGeometry dcache;
+  string cacheReport = "cache.txt";
+  // no terminal input, the output and the final state are kept in the emulator instead of going to cout
+  bool headless = false;
+  // the run stops once this many instructions have been retired
+  uint64_t maxInstructions = UINT64_MAX;
+  // guest cores, each one runs on its own thread
+  unsigned cores = 1;
+  // the literal idioms of the assembler are decoded into one operation, not with the profiler or a trace
+  bool fusion = true;
+  // driven by EmbeddedEmulator, an idle guest ends the run quietly so that the host can post an event
+  bool embedded = false;
+};
+
 class Emulator {
+  friend class Jit;
+  friend class EmbeddedEmulator;
+  friend class GdbStub;
+
 private:
   string inputFileName;
+  emulatorOptions options;
+  size_t imageBytes = 0;
+
+  // cout, or captured when headless
+  ostream *out = &cout;
+  ostringstream captured;
+
+  struct termios savedTermios;
+  bool rawMode = false;
+
+
+  // core 0 owns the memory and the devices, the other cores are emulators that use them through machine
+  Emulator *machine;
+  uint32_t coreId = 0;
+  bool multiCore = false;
+  vector<unique_ptr<Emulator>> cores;
+  mutex deviceMutex;
+
+  // only for core 0, a secondary core would reserve a whole address space of its own for nothing
+  unique_ptr<Memory> ownMemory;
+  Memory &memory;
+  unique_ptr<DeviceRegistry> ownDevices;
+  DeviceRegistry &devices;
+  DecodeCache decodeCache;
+  uint32_t gprs[16] = {};
+  // csr operands have four bits, the ones past coreid are plain storage
+  uint32_t csrs[16] = {};
+
+  uint64_t instructionCount = 0;
+  // every fetch goes through fetchSlow, with more than one core, a profiler, a trace or statistics
+  bool slowFetch = false;
+
+  // counters of the guest next to instructionCount, in the statistics report and readable by the guest at COUNTERS_START;
+  // memory accesses and the opcodes, retired instructions by OC, are only counted with statistics,
+  // mmio accesses are those that touch a device region and interrupts are the ones taken
+  enum counterId {
+    MEMORY_READS, MEMORY_WRITES, MMIO_READS, MMIO_WRITES, TIMER_INTERRUPTS, TERMINAL_INTERRUPTS, SOFTWARE_INTERRUPTS, DMA_INTERRUPTS,
+    OPCODES
+  };
+  // the last group has the OCs without instructions
+  static const uint32_t OPCODE_GROUPS = 11;
+  uint64_t counters[OPCODES + OPCODE_GROUPS] = {};
+  bool stats = false;
+  // loads and stores go through countAccess, with statistics or a cache model
+  bool countAccesses = false;
+  chrono::steady_clock::time_point runStart;
+  thread statsThread;
+
+  // core in the callbacks of a device access, set under the device lock with several cores
+  Emulator *accessingCore = this;
+  // the high word of a counter is the one of the last read of its low word
+  uint64_t latchedCounter = 0;
+
+  // fused idioms executed whole by op and the instructions they retired
+  bool fusion = false;
+  uint64_t fusedCounts[DecodeCache::FUSED_OPS] = {};
+  uint64_t fusedInstructions = 0;
+
+  Jit jit;
+  unique_ptr<Profiler> profiler;
+  unique_ptr<Tracer> tracer;
+  unique_ptr<GdbStub> debugger;
+  unique_ptr<CacheModel> caches;
 
+  // cores that have decoded instructions from a page, indexed by page number and kept by core 0;
+  // a store to the page makes the other cores drop everything they have decoded before their next fetch
+  unique_ptr<atomic<uint32_t>[]> codeOwners;
+  atomic<bool> dropDecoded{false};
 
-  map<uint32_t, uint8_t> memory;
-  vector<uint32_t> gprs;
-  vector<uint32_t> csrs;
+  static const uint8_t STATUS_CSR = 0;
+  // read only csr with the number of the core
+  static const uint8_t COREID_CSR = 3;
 
 
-  atomic<bool> end;
+  atomic<bool> end{false};
   thread timerThread;
+  thread terminalThread;
+  int terminalWakeFds[2];
 
   const uint32_t TERM_OUT_START = 0xFFFFFF00;
   const uint32_t TERM_OUT_END = 0xFFFFFF03;
@@ -31,35 +163,207 @@ private:
   const uint32_t TIM_CFG_START = 0xFFFFFF10;
   const uint32_t TIM_CFG_END = 0xFFFFFF13;
 
-  sem_t mutex;
+  // source, or the byte of a fill in its low bits, destination, length in bytes and control; a store to control with
+  // DMA_RUN runs the whole transfer on the host before the next instruction and leaves DMA_DONE or DMA_ERROR in it
+  const uint32_t DMA_SRC = 0xFFFFFF30;
+  const uint32_t DMA_DST = 0xFFFFFF34;
+  const uint32_t DMA_LEN = 0xFFFFFF38;
+  const uint32_t DMA_CTRL = 0xFFFFFF3C;
+  const uint32_t DMA_END = 0xFFFFFF3F;
+  static const uint32_t DMA_RUN = 0x1;
+  static const uint32_t DMA_FILL = 0x2;
+  static const uint32_t DMA_INTERRUPT_ENABLE = 0x4;
+  static const uint32_t DMA_DONE = 0x8;
+  static const uint32_t DMA_ERROR = 0x10;
+
+  // read only, 64-bit little endian counters: instructions, memory reads, memory writes, mmio reads, mmio writes,
+  // timer, terminal, software and DMA interrupts, then the opcode groups; in translated code the instructions are
+  // those retired before the block
+  const uint32_t COUNTERS_START = 0xFFFFFF40;
+  const uint32_t COUNTERS_END = 0xFFFFFF40 + (1 + OPCODES + OPCODE_GROUPS) * 8 - 1;
+
+  // written by the processor thread on a store to TIM_CFG, -1 until then
+  atomic<int> timerConfig{-1};
+  // the timer thread sleeps here until its next deadline, a store to TIM_CFG or the end of the run
+  mutex timerMutex;
+  condition_variable timerWakeup;
+  // set with the mutex held by a store to TIM_CFG, the next period starts from the time of the store
+  bool timerRearmed = true;
+
+  // interrupt requests posted by the devices, bits are the same as the mask bits in status
+  static const uint32_t TIMER_INTERRUPT = 0x1;
+  static const uint32_t TERMINAL_INTERRUPT = 0x2;
+  // posted by int, its bit in status is the global mask
+  static const uint32_t SOFTWARE_INTERRUPT = 0x4;
+  // the end of a DMA transfer, masked by bit 3 of status
+  static const uint32_t DMA_INTERRUPT = 0x8;
+  // not an interrupt, SIGUSR1 asks for a statistics report between two instructions
+  static const uint32_t STATS_REQUEST = 0x80000000;
+  // not an interrupt either, gdb sent something or a watchpoint was hit, the debugger stops the guest
+  static const uint32_t DEBUG_REQUEST = 0x40000000;
+  atomic<uint32_t> pendingInterrupts{0};
+  // pending bits that stop the processor between two instructions, kept in step with status by statusChanged
+  uint32_t acceptedRequests = TIMER_INTERRUPT | TERMINAL_INTERRUPT | SOFTWARE_INTERRUPT | DMA_INTERRUPT | STATS_REQUEST | DEBUG_REQUEST;
+  // instructionCount after the last write to status by the guest
+  uint64_t statusWrittenAt = UINT64_MAX;
+
+  // in priority order, entering the handler sets the request's bit in status
+  struct interruptSource {
+    uint32_t request;
+    uint32_t cause;
+    counterId counter;
+  };
+  static constexpr interruptSource INTERRUPT_SOURCES[] = {
+    {SOFTWARE_INTERRUPT, 4, SOFTWARE_INTERRUPTS}, {TIMER_INTERRUPT, 2, TIMER_INTERRUPTS},
+    {TERMINAL_INTERRUPT, 3, TERMINAL_INTERRUPTS}, {DMA_INTERRUPT, 5, DMA_INTERRUPTS}
+  };
+
+  // the processor sleeps here while the guest is in an idle loop, device threads notify after posting a request
+  mutex idleMutex;
+  condition_variable idleWakeup;
+
+  // in virtual time the processor posts the timer request itself once instructionCount reaches the deadline
+  uint64_t timerDeadline = UINT64_MAX;
+
+  // handleInterrupts runs once instructionCount reaches the earlier of the timer deadline and the checkpoint
+  uint64_t checkpointAt = UINT64_MAX;
+  uint64_t stopAt = UINT64_MAX;
+  bool stopRequested = false;
+  // end of a bounded run of the embedded emulator, it stops without a message
+  uint64_t pauseAt = UINT64_MAX;
+  // the debugger stops the guest here, the end of a single step or the first instruction
+  uint64_t debugAt = UINT64_MAX;
+  uint64_t eventDeadline = UINT64_MAX;
+  void updateDeadline() { eventDeadline = stopRequested ? 0 : min({timerDeadline, checkpointAt, stopAt, pauseAt, debugAt}); }
+
+  bool halted = false;
+  bool idleStopped = false;
+
+  // time skipped in virtual time and time slept in real time
+  uint64_t skippedInstructions = 0;
+  double idleSeconds = 0;
+  uint64_t idleLoops = 0;
+
+  // the JIT engine interprets IDLE_SAMPLE instructions to look for idle loops, at most every MAX_SAMPLE_INTERVAL runs
+  static const int IDLE_SAMPLE = 64;
+  static const uint32_t MAX_SAMPLE_INTERVAL = 1024;
+
+  // state at the last backward jump, reaching it again with no stores in between means the guest is idle
+  uint64_t storeCount = 0;
+  struct loopState {
+    uint32_t target = 0;
+    uint64_t stores = 0;
+    uint32_t gprs[16] = {};
+  } idleLoop;
+
+  // characters read by the terminal thread that the processor hasn't taken yet
+  static const uint32_t TERMINAL_BUFFER_SIZE = 256;
+  char terminalBuffer[TERMINAL_BUFFER_SIZE];
+  atomic<uint32_t> terminalHead{0};
+  atomic<uint32_t> terminalTail{0};
+  // false once stdin is closed, or from the start when headless
+  atomic<bool> terminalOpen{false};
+
+  Emulator(Emulator *, uint32_t);
+
+  // one handler per op of the decode cache, generated from instruction
+  typedef bool (Emulator::*instructionHandler)(DecodeCache::decodedInstruction);
+  static const array<instructionHandler, 256> instructionHandlers;
+  template<size_t... OPS> static constexpr array<instructionHandler, 256> handlerTable(index_sequence<OPS...>);
+  template<uint8_t OP> bool instruction(DecodeCache::decodedInstruction);
+  template<uint8_t MOD> void fused(uint32_t, uint8_t, uint8_t, uint8_t, int32_t);
+  bool breakpoint(DecodeCache::decodedInstruction);
 
 public:
-  Emulator(char *);
+  // one bit per core in the code owners
+  static const uint32_t MAX_CORES = 32;
+
+  Emulator(char *, emulatorOptions);
   ~Emulator();
   void emulate();
 
-  void hexRead();
+  bool hexRead();
+  bool hexParse(const uint8_t *, size_t);
+  void startDevices();
+  string output() const { return captured.str(); }
+  bool saveCheckpoint(const string &);
+  bool restoreCheckpoint(const string &);
+  // inlined into the engines, gcc doesn't inline into threadedInstructions on its own because of its size;
+  // the common case is a hit in the decode cache of one core without a profiler or a trace
+  __attribute__((always_inline)) DecodeCache::decodedInstruction *fetch() {
+    DecodeCache::decodedInstruction *decoded = slowFetch ? nullptr : decodeCache.find(gprs[15]);
+    if(!decoded) decoded = fetchSlow();
+    gprs[15] = gprs[15] + 4;
+    instructionCount++;
+    return decoded;
+  }
+  DecodeCache::decodedInstruction *fetchSlow();
+  // operands are passed by value, a store from this instruction may invalidate the cache entry
+  bool execute(DecodeCache::decodedInstruction *decoded) { return (this->*instructionHandlers[decoded->op])(*decoded); }
   void emulatingInstructions();
+  bool step() {
+    if(eventsDue() && !handleInterrupts()) return false;
+    return execute(fetch());
+  }
+  void threadedInstructions();
+  void jitInstructions();
+  void run();
+  Emulator *core(uint32_t id) { return id ? cores[id - 1].get() : this; }
+  void ownCode(const DecodeCache::decodedInstruction *);
+  void dropDecodedInstructions();
+  void invalidateOtherCores(uint32_t);
   void printState();
+  void printMips(double);
+  void printFootprint();
 
   void interrupt();
-  void call(uint8_t, uint8_t, uint8_t, int32_t);
-  void jump(uint8_t, uint8_t, uint8_t, uint8_t, int32_t);
-  void xchg(uint8_t, uint8_t);
-  void arit(uint8_t, uint8_t, uint8_t, uint8_t);
-  void log(uint8_t, uint8_t, uint8_t, uint8_t);
-  void shift(uint8_t, uint8_t, uint8_t, uint8_t);
-  void st(uint8_t, uint8_t, uint8_t, uint8_t, int32_t);
-  void ld(uint8_t, uint8_t, uint8_t, uint8_t, int32_t);
+  void postInterrupt(uint32_t);
+  void notifyProcessor();
+  // the check before every instruction, a request that status masks stays pending without stopping the processor
+  __attribute__((always_inline)) bool eventsDue() { return (pendingInterrupts.load(memory_order_relaxed) & acceptedRequests) || instructionCount >= eventDeadline; }
+  bool handleInterrupts();
+  void deliverInterrupt();
+  uint32_t enabledInterrupts();
+  void statusChanged() { acceptedRequests = enabledInterrupts() | STATS_REQUEST | DEBUG_REQUEST; }
+  // the instruction after a write to status is never interrupted, it's the pop of pc that ends an iret
+  void writeCsr(uint8_t csr, uint32_t value) {
+    if(csr == COREID_CSR) return;
+    csrs[csr] = value;
+    if(csr != STATUS_CSR) return;
+    statusWrittenAt = instructionCount;
+    statusChanged();
+  }
 
   uint32_t read4Bytes(uint32_t);
+  void countAccess(uint32_t, bool);
   void write4Bytes(uint32_t, uint32_t);
+  uint32_t deviceRead(uint32_t);
+  void deviceWrite(uint32_t, uint32_t);
+  void hostWrite(uint32_t, const uint8_t *, size_t);
+  void codeWritten(uint32_t, size_t);
+  void addDevices();
+  uint64_t counterValue(uint32_t);
+  uint32_t counterRead(uint32_t);
+  bool writeStats(bool);
+  void blockStatsSignal();
+  void startStatsSignal();
+  void emulatingStatsSignal();
+  void terminalWrite(uint32_t, uint32_t);
+  void timerWrite(uint32_t, uint32_t);
+  void dmaWrite(uint32_t, uint32_t);
+  bool dmaTransfer(uint32_t, uint32_t, uint32_t, bool);
 
   void emulatingTerminal();
+  size_t terminalInput(const char *, size_t);
   void setRawMode(bool);
   void setNonBlocking(bool);
 
+  void startTimer();
   void emulatingTimer();
+  void virtualTimer();
+  void idleCheck();
+  bool canWake(uint32_t);
+  void idleWait();
   int getTimerPeriod(int);
 };
 
@@ -0,0 +1,89 @@
+#ifndef GDB_STUB_H
+#define GDB_STUB_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+class Emulator;
+
+// Remote serial protocol server for one gdb on a local TCP port or a Unix socket. Its commands are served on the
+// processor thread between two instructions; while the guest runs, a watcher thread only polls the socket and
+// a byte from gdb asks the processor to stop
+class GdbStub {
+public:
+  // types of the Z packets, 0 and 1 are breakpoints
+  enum watchKind { WRITE_WATCH = 2, READ_WATCH = 3, ACCESS_WATCH = 4 };
+
+private:
+  // r0 to r15, then status, handler and cause
+  static const uint32_t REGISTERS = 19;
+  static const uint32_t PACKET_SIZE = 4096;
+
+  struct watchpoint {
+    uint32_t start;
+    uint32_t end;
+    uint8_t kind;
+  };
+
+  Emulator *emulator;
+  string address;
+  int listenFd = -1;
+  int fd = -1;
+  string input;
+  bool noAck = false;
+  // gdb resumed the guest and waits for a stop reply
+  bool waiting = false;
+
+  vector<watchpoint> watchpoints;
+  // the first watchpoint hit since the guest was resumed
+  bool watchHit = false;
+  uint8_t hitKind = 0;
+  uint32_t hitAddress = 0;
+
+  // a breakpoint at the pc the guest was resumed from doesn't stop it again
+  uint32_t resumePc = 0;
+  uint64_t resumeCount = UINT64_MAX;
+
+  thread watcherThread;
+  mutex watchMutex;
+  condition_variable watchWakeup;
+  bool running = false;
+  bool polling = false;
+  bool interrupted = false;
+  bool finished = false;
+  int wakeFds[2] = {-1, -1};
+
+  bool receive(string &);
+  void send(const string &);
+  string stopReply();
+  string command(const string &, bool &);
+  uint32_t registerValue(uint32_t);
+  string readRegisters();
+  bool writeRegister(uint32_t, uint32_t);
+  bool setPoint(const string &, bool);
+  void updateWatches();
+  void resume(bool);
+  void detach();
+  void watching();
+
+public:
+  GdbStub(Emulator *, const string &);
+  ~GdbStub();
+
+  bool listen();
+  bool accept();
+  bool connected() const { return fd >= 0; }
+  bool resumedFrom(uint32_t pc, uint64_t count) const { return pc == resumePc && count == resumeCount; }
+
+  void stop();
+  void access(uint32_t, bool);
+  void exited();
+};
+
+#endif // GDB_STUB_H
@@ -0,0 +1,123 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <atomic>
+
+using namespace std;
+
+class Emulator;
+
+// Translates guest basic blocks to x86-64, guest registers stay in memory and are addressed through rbx
+class Jit {
+public:
+  // SHORT_LIMIT: the block is longer than the instructions left before the next event, nothing was run
+  enum exitCode { CONTINUE = 0, HALT = 1, SHORT_LIMIT = 2 };
+
+  struct jitBlock;
+
+  struct jitExit {
+    uint8_t *patchSite;
+    uint32_t target;
+    jitBlock *from;
+  };
+
+  struct jitBlock {
+    uint32_t pc;
+    uint8_t *entry;
+    uint8_t *body;
+    bool valid;
+    // most instructions a run through the block retires, the fallback at its end included
+    int length;
+    vector<pair<uint32_t, uint32_t>> ranges;
+    deque<jitExit> exits;
+    vector<jitExit *> incoming;
+  };
+
+  // layout is used by the generated code, see the offsets in jit.cpp
+  struct jitState {
+    uint32_t *gprs;
+    Jit *jit;
+    Emulator *emulator;
+    uint64_t instructions;
+    jitExit *lastExit;
+    int32_t budget;
+    atomic<uint32_t> *pending;
+    uint32_t enabled;
+    // the instructionCount of the emulator, instructions are added to it when the block returns
+    uint64_t *retired;
+  };
+
+private:
+  static const size_t CODE_SIZE = 32 << 20;
+  static const size_t BLOCK_RESERVE = 64 << 10;
+  static const int MAX_BLOCK_INSTRUCTIONS = 64;
+  static const int32_t BUDGET = 4096;
+  static const uint32_t PAGE_BITS = 12;
+  static const uint32_t LINE_BITS = 4;
+
+  // translated bytes of a page in 16 byte lines, stores outside of them don't touch the blocks
+  struct codePage {
+    uint64_t lines[4];
+    vector<jitBlock *> blocks;
+  };
+
+  Emulator *emulator;
+  jitState state;
+
+  uint8_t *code = nullptr;
+  uint8_t *codePtr = nullptr;
+
+  unordered_map<uint32_t, jitBlock *> blocks;
+  vector<unique_ptr<jitBlock>> allBlocks;
+  vector<bool> codePages;
+  unordered_map<uint32_t, codePage> pageBlocks;
+
+  void emit8(uint8_t);
+  void emit32(uint32_t);
+  void emit64(uint64_t);
+  void emitEpilogue();
+  void loadGuest(int, uint8_t, uint32_t);
+  void storeGuest(uint8_t, int);
+  void storeGuestImm(uint8_t, uint32_t);
+  void emitAddress(uint8_t, uint8_t, int32_t, uint32_t);
+  void emitCall(void *);
+  void emitRead();
+  void emitWrite(int, uint32_t);
+  void emitCounters(int);
+  void emitExit(jitBlock *, int, uint32_t);
+  void emitDynamicExit(int);
+  void emitFallback(int, uint32_t);
+
+  bool foldLiteral(jitBlock *, uint32_t, uint32_t &);
+  void addRange(jitBlock *, uint32_t);
+  void markLines(codePage &, jitBlock *, uint32_t);
+  void invalidateBlock(jitBlock *);
+  jitBlock *translate(uint32_t);
+  void link(jitExit *, jitBlock *);
+  void flush();
+
+public:
+  bool invalidated = false;
+
+  Jit(Emulator *, uint32_t *, atomic<uint32_t> *);
+  ~Jit();
+
+  bool available();
+  exitCode execute(uint32_t, uint64_t &, uint64_t);
+
+  void invalidate(uint32_t address) {
+    if(codePages[address >> PAGE_BITS]) invalidateRange(address >> PAGE_BITS, address);
+    if((address + 3) >> PAGE_BITS != address >> PAGE_BITS && codePages[(address + 3) >> PAGE_BITS]) invalidateRange((address + 3) >> PAGE_BITS, address);
+  }
+  void invalidateRange(uint32_t, uint32_t);
+  void invalidate(uint32_t, size_t);
+};
+
+#endif // JIT_H
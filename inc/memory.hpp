@@ -0,0 +1,70 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Guest memory: the whole 32-bit address space is reserved with one mapping that commits nothing up front,
+// the host commits a page on the first write to it and an access is the base plus the address.
+// Several cores may use it at once: aligned words are read with acquire and written with release
+// so a core sees the stores of another one in program order
+class Memory {
+public:
+  static const uint32_t PAGE_BITS = 12;
+  static const uint32_t PAGE_SIZE = 1 << PAGE_BITS;
+  static const uint32_t PAGE_MASK = PAGE_SIZE - 1;
+  static const uint64_t SPACE_SIZE = static_cast<uint64_t>(1) << 32;
+
+private:
+  // nullptr when the host refused the reservation
+  uint8_t *base;
+  // pages mapped from a checkpoint, mincore would tell whether the file is cached instead of whether the guest
+  // touched them, so they count as touched; empty until a file is mapped
+  vector<bool> filePages;
+
+public:
+  Memory();
+  ~Memory();
+
+  bool valid() const { return base != nullptr; }
+  uint8_t *pointer(uint32_t address) const { return base + address; }
+
+  uint8_t read8(uint32_t address) const { return base[address]; }
+  void write8(uint32_t address, uint8_t value) { base[address] = value; }
+
+  // a word at the last three addresses wraps around to address 0, guest and host are both little endian
+  uint32_t read32(uint32_t address) const {
+    if(!(address & 3)) return __atomic_load_n(reinterpret_cast<uint32_t *>(base + address), __ATOMIC_ACQUIRE);
+    uint32_t value = 0;
+    if(address <= UINT32_MAX - 3) memcpy(&value, base + address, 4);
+    else for(int i = 0; i < 4; i++) value |= read8(address + i) << 8 * i;
+    return value;
+  }
+
+  void write32(uint32_t address, uint32_t value) {
+    if(!(address & 3)) __atomic_store_n(reinterpret_cast<uint32_t *>(base + address), value, __ATOMIC_RELEASE);
+    else if(address <= UINT32_MAX - 3) memcpy(base + address, &value, 4);
+    else for(int i = 0; i < 4; i++) write8(address + i, static_cast<uint8_t>((value >> 8 * i) & 0xFF));
+  }
+
+  void writeBlock(uint32_t, const uint8_t *, size_t);
+  void copyBlock(uint32_t, uint32_t, size_t);
+  void fillBlock(uint32_t, uint8_t, size_t);
+
+  // pages the host has mapped, written or read at least once and pages mapped from a file, in address order
+  vector<uint32_t> touchedPages() const;
+  // bytes of the reservation the host has committed
+  size_t residentBytes() const;
+
+  template<typename F> void forEachPage(F visit) const {
+    for(uint32_t address : touchedPages()) visit(address, const_cast<const uint8_t *>(base + address));
+  }
+
+  bool mapFile(int, size_t, uint32_t, size_t);
+};
+
+#endif // MEMORY_H
@@ -0,0 +1,60 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+#include "memory.hpp"
+
+using namespace std;
+
+// Retired instructions per guest pc, counters are kept per code page like the pages of Memory,
+// the calling context is tracked on calls and returns for the folded stacks
+class Profiler {
+private:
+  static const uint32_t PAGE_BITS = 12;
+  static const uint32_t PAGE_SLOTS = 1 << (PAGE_BITS - 2);
+  static const uint32_t TABLE_BITS = 10;
+  static const uint32_t TABLE_SIZE = 1 << TABLE_BITS;
+  static const uint32_t TABLE_MASK = TABLE_SIZE - 1;
+
+  uint64_t **directory[TABLE_SIZE];
+
+  // node 0 is the program entry, every other node is a function called from its parent
+  struct stackNode {
+    uint32_t parent;
+    uint32_t function;
+    uint64_t instructions;
+  };
+
+  vector<stackNode> stacks;
+  map<pair<uint32_t, uint32_t>, uint32_t> children;
+  uint32_t current = 0;
+
+  uint64_t *allocatePage(uint32_t);
+  string stackName(uint32_t);
+
+public:
+  Profiler(uint32_t);
+  ~Profiler();
+
+  // pcs that aren't a multiple of 4 share the counter of the word they are in
+  void count(uint32_t pc) {
+    uint64_t **table = directory[pc >> (PAGE_BITS + TABLE_BITS)];
+    uint64_t *page = table ? table[(pc >> PAGE_BITS) & TABLE_MASK] : nullptr;
+    if(!page) page = allocatePage(pc);
+    page[(pc >> 2) & (PAGE_SLOTS - 1)]++;
+    stacks[current].instructions++;
+  }
+
+  void call(uint32_t);
+  void ret();
+
+  bool write(const string &, const Memory &);
+};
+
+#endif // PROFILER_H
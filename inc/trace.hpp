@@ -0,0 +1,93 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <fstream>
+
+using namespace std;
+
+// Records the run of one processor thread, the events go through a single producer ring
+// to a writer thread that encodes them into the file
+class Tracer {
+public:
+  enum eventKind { INSTRUCTION = 0, STORE = 1, INTERRUPT = 2 };
+
+  // every event in the file starts with a tag byte whose low two bits are the kind; pcs are zigzag varints relative
+  // to the previous one, an instruction word is left out when it is the word last seen at that pc and a store is a
+  // zigzag delta to the address and the value of the last store of the same pc, the tables are direct mapped
+  // and the decoder keeps them the same way
+  static const uint8_t NEXT_PC = 0x4;
+  static const uint8_t KNOWN_WORD = 0x8;
+  static const uint32_t WORD_TABLE_SIZE = 4096;
+  static uint32_t wordSlot(uint32_t pc) { return (pc >> 2) & (WORD_TABLE_SIZE - 1); }
+
+  struct traceEvent {
+    uint32_t kind;
+    uint32_t first;
+    uint32_t second;
+  };
+
+private:
+  static const uint32_t RING_BITS = 16;
+  static const uint32_t RING_SIZE = 1 << RING_BITS;
+
+  vector<traceEvent> ring;
+  atomic<uint64_t> head{0};
+  atomic<uint64_t> tail{0};
+  // tail as last seen by the processor, it is loaded again only when the ring looks full
+  uint64_t freeUntil = RING_SIZE;
+
+  atomic<bool> finished{false};
+  thread writerThread;
+  ofstream file;
+  bool failed = false;
+
+  void writer();
+  void waitForSpace();
+
+  void push(uint32_t kind, uint32_t first, uint32_t second) {
+    uint64_t position = head.load(memory_order_relaxed);
+    if(position == freeUntil) waitForSpace();
+    ring[position & (RING_SIZE - 1)] = {kind, first, second};
+    head.store(position + 1, memory_order_release);
+  }
+
+public:
+  Tracer(const string &);
+  ~Tracer();
+
+  bool good() const { return file.is_open() && !failed; }
+  // waits until the writer has written everything, false if the file couldn't be written
+  bool finish();
+
+  void instruction(uint32_t pc, uint32_t word) { push(INSTRUCTION, pc, word); }
+  void store(uint32_t address, uint32_t value) { push(STORE, address, value); }
+  // for the terminal the value is the character in TERM_IN
+  void interrupt(uint32_t cause, uint32_t value) { push(INTERRUPT, cause, value); }
+};
+
+// Reads the events back in order, used by the decoder tool
+class TraceReader {
+private:
+  ifstream file;
+  bool valid = false;
+  uint32_t pc = 0;
+  vector<uint32_t> words;
+  vector<uint32_t> addresses;
+  vector<uint32_t> values;
+
+  bool readVarint(uint64_t &);
+
+public:
+  TraceReader(const string &);
+
+  bool good() const { return valid; }
+  bool next(Tracer::traceEvent &);
+};
+
+#endif // TRACE_H
@@ -44,6 +44,7 @@ int getRegNum(char *regName) {
   else if(strcmp(regName, "status") == 0) return 16;
   else if(strcmp(regName, "handler") == 0) return 17;
   else if(strcmp(regName, "cause") == 0) return 18;
+  else if(strcmp(regName, "coreid") == 0) return 19;
   return -1;
 }
 
@@ -155,6 +156,7 @@ void printOperand(struct operandArgs *op) {
   else if(op->type == regType && op->regNum == 16) printf("%%status");
   else if(op->type == regType && op->regNum == 17) printf("%%handler");
   else if(op->type == regType && op->regNum == 18) printf("%%cause");
+  else if(op->type == regType && op->regNum == 19) printf("%%coreid");
   else if(op->type == regMemType) printf("[%%r%d]", op->regNum);
   else if(op->type == regMemLitType) printf("[%%r%d + %d]", op->regNum, op->literal);
   else if(op->type == regMemSymType) printf("[%%r%d + %s]", op->regNum, op->symbol);
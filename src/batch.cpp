@@ -0,0 +1,95 @@
+#include "./../inc/batch.hpp"
+
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <sys/mman.h>
+
+BatchRunner::BatchRunner(const vector<string> &imageFiles, emulatorOptions options) {
+  this->options = options;
+  this->options.headless = true;
+
+  for(auto &image : imageFiles) {
+    results.push_back({image, "", 0});
+    if(!images.count(image)) images[image] = unique_ptr<sharedImage>(new sharedImage());
+  }
+}
+
+BatchRunner::~BatchRunner() {
+  for(auto &image : images) {
+    if(image.second->fd >= 0) close(image.second->fd);
+  }
+}
+
+void BatchRunner::load(const string &fileName, sharedImage &image) {
+  image.fd = memfd_create("emulator-image", 0);
+  if(image.fd < 0) {
+    image.error = "Unable to create the shared image\n";
+    return;
+  }
+  image.checkpoint = "/proc/self/fd/" + to_string(image.fd);
+
+  emulatorOptions loadOptions = options;
+  loadOptions.profile.clear();
+  string name = fileName;
+  Emulator loader(&name[0], loadOptions);
+  if(!loader.hexRead()) {
+    image.error = loader.output() + "\n";
+    return;
+  }
+  image.valid = loader.saveCheckpoint(image.checkpoint);
+  if(!image.valid) image.error = "Unable to write the shared image\n";
+}
+
+// the own queue is used from the back, the others are robbed from the front
+bool BatchRunner::take(size_t worker, size_t &task) {
+  for(size_t i = 0; i < queues.size(); i++) {
+    workQueue &queue = *queues[(worker + i) % queues.size()];
+    lock_guard<mutex> lock(queue.lock);
+    if(queue.tasks.empty()) continue;
+
+    if(i == 0) {
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+    } else {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+void BatchRunner::worker(size_t id) {
+  size_t task;
+  while(take(id, task)) {
+    batchResult &result = results[task];
+    sharedImage &image = *images.at(result.image);
+    call_once(image.loaded, &BatchRunner::load, this, cref(result.image), ref(image));
+    if(!image.valid) {
+      result.output = image.error;
+      continue;
+    }
+
+    auto start = chrono::steady_clock::now();
+    emulatorOptions runOptions = options;
+    runOptions.restoreFile = image.checkpoint;
+    string name = result.image;
+    Emulator emulator(&name[0], runOptions);
+    emulator.emulate();
+    result.output = emulator.output();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+  }
+}
+
+void BatchRunner::run(unsigned threads) {
+  if(threads == 0) threads = 1;
+  queues.clear();
+  for(unsigned i = 0; i < threads; i++) queues.push_back(unique_ptr<workQueue>(new workQueue()));
+  for(size_t task = 0; task < results.size(); task++) queues[task % threads]->tasks.push_back(task);
+
+  vector<thread> workers;
+  for(unsigned i = 0; i < threads; i++) workers.push_back(thread(&BatchRunner::worker, this, i));
+  for(auto &worker : workers) worker.join();
+}
@@ -0,0 +1,107 @@
+#include "./../inc/cacheModel.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+static uint32_t floorLog2(uint32_t value) {
+  uint32_t bits = 0;
+  while(value >> (bits + 1)) bits++;
+  return bits;
+}
+
+static bool powerOfTwo(uint32_t value) {
+  return value && !(value & (value - 1));
+}
+
+Cache::Cache(const cacheGeometry &geometry) : geometry(geometry) {
+  uint32_t setCount = geometry.size / geometry.line / geometry.ways;
+  lineBits = floorLog2(geometry.line);
+  setMask = setCount - 1;
+  ways = geometry.ways;
+  sets.resize(static_cast<size_t>(setCount) * ways, {0, false, false, 0});
+}
+
+bool Cache::valid(const cacheGeometry &geometry) {
+  if(!powerOfTwo(geometry.line) || geometry.line < 4 || !geometry.ways) return false;
+  if(geometry.size % (static_cast<uint64_t>(geometry.line) * geometry.ways)) return false;
+  return powerOfTwo(geometry.size / geometry.line / geometry.ways);
+}
+
+// the way used longest ago is replaced, an empty way has never been used
+bool Cache::accessLine(uint32_t line, bool write) {
+  way *set = &sets[static_cast<size_t>(line & setMask) * ways];
+  way *victim = set;
+  clock++;
+  for(uint32_t i = 0; i < ways; i++) {
+    if(set[i].valid && set[i].line == line) {
+      set[i].lastUse = clock;
+      set[i].dirty = set[i].dirty || write;
+      return true;
+    }
+    if(set[i].lastUse < victim->lastUse) victim = &set[i];
+  }
+
+  if(victim->valid && victim->dirty) writebacks++;
+  *victim = {line, true, write, clock};
+  return false;
+}
+
+CacheModel::CacheModel(const cacheGeometry &instructions, const cacheGeometry &data) {
+  if(instructions.size) instructionCache.reset(new Cache(instructions));
+  if(data.size) dataCache.reset(new Cache(data));
+}
+
+static void writeSummary(ofstream &report, const char *name, const Cache &cache) {
+  const cacheGeometry &geometry = cache.geometry;
+  report << name << ": " << dec << geometry.size << " bytes, " << geometry.line << " byte lines, " << geometry.ways << " ways, ";
+  report << geometry.size / geometry.line / geometry.ways << " sets\n";
+  report << "  accesses " << cache.accesses << " (" << cache.writes << " writes), misses " << cache.misses;
+  report << " (" << fixed << setprecision(2) << (cache.accesses ? 100.0 * cache.misses / cache.accesses : 0) << "%)";
+  report << ", write-backs " << cache.writebacks << "\n";
+}
+
+// most misses first, the lines for a pc show its instruction
+template<typename K> static void writeCounts(ofstream &report, const unordered_map<uint32_t, K> &byKey, const Memory *memory, uint32_t regionBits) {
+  vector<pair<uint32_t, K>> rows(byKey.begin(), byKey.end());
+  sort(rows.begin(), rows.end(), [](const pair<uint32_t, K> &a, const pair<uint32_t, K> &b) {
+    return a.second.misses != b.second.misses ? a.second.misses > b.second.misses : a.first < b.first;
+  });
+
+  for(auto &row : rows) {
+    if(memory) {
+      report << "0x" << hex << setw(8) << setfill('0') << row.first << "   0x" << setw(8) << memory->read32(row.first);
+    } else {
+      uint32_t start = row.first << regionBits;
+      report << "0x" << hex << setw(8) << setfill('0') << start << "-0x" << setw(8) << start + ((1 << regionBits) - 1);
+    }
+    report << dec << setfill(' ') << setw(14) << row.second.accesses << setw(12) << row.second.misses;
+    report << setw(9) << fixed << setprecision(2) << 100.0 * row.second.misses / row.second.accesses << "\n";
+  }
+}
+
+bool CacheModel::write(const string &file, const Memory &memory) {
+  ofstream report(file);
+  if(!report.is_open()) return false;
+
+  if(instructionCache) writeSummary(report, "I-cache", *instructionCache);
+  if(dataCache) writeSummary(report, "D-cache", *dataCache);
+
+  if(instructionCache) {
+    report << "\nI-cache misses by pc\n";
+    report << "        pc  instruction       fetches      misses   miss %\n";
+    writeCounts(report, fetchesByPc, &memory, 0);
+  }
+  if(dataCache) {
+    report << "\nD-cache misses by pc\n";
+    report << "        pc  instruction      accesses      misses   miss %\n";
+    writeCounts(report, dataByPc, &memory, 0);
+
+    report << "\nD-cache misses by region of " << dec << (1 << REGION_BITS) << " bytes\n";
+    report << "               region      accesses      misses   miss %\n";
+    writeCounts(report, dataByRegion, nullptr, REGION_BITS);
+  }
+
+  report.close();
+  return report.good();
+}
@@ -0,0 +1,130 @@
+#include "./../inc/emulator.hpp"
+
+#include <fstream>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Checkpoint file: the header, the addresses of the saved pages, then the pages themselves
+// starting at a page boundary so that a restore can map them instead of reading them
+struct checkpointHeader {
+  char magic[8];
+  uint32_t gprs[16];
+  // coreid is left at 0, it belongs to the core that restores
+  uint32_t csrs[16];
+  int32_t timerConfig;
+  uint64_t instructionCount;
+  // instructions left until the virtual timer fires, UINT64_MAX when it isn't running
+  uint64_t timerRemaining;
+  uint32_t pendingInterrupts;
+  uint32_t terminalCount;
+  char terminal[256];
+  uint32_t pageCount;
+};
+
+static const char CHECKPOINT_MAGIC[8] = {'E', 'M', 'U', 'C', 'K', 'P', 'T', '2'};
+
+static size_t pagesOffset(uint32_t pageCount) {
+  size_t size = sizeof(checkpointHeader) + pageCount * sizeof(uint32_t);
+  return (size + Memory::PAGE_SIZE - 1) & ~static_cast<size_t>(Memory::PAGE_MASK);
+}
+
+// Called between two instructions, pages that are all zeros are left out
+bool Emulator::saveCheckpoint(const string &fileName) {
+  static_assert(sizeof(checkpointHeader::terminal) == TERMINAL_BUFFER_SIZE, "checkpoint keeps the whole terminal buffer");
+
+  vector<uint32_t> pages;
+  memory.forEachPage([&pages](uint32_t address, const uint8_t *page) {
+    for(uint32_t i = 0; i < Memory::PAGE_SIZE; i++) {
+      if(page[i]) {
+        pages.push_back(address);
+        return;
+      }
+    }
+  });
+
+  checkpointHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  copy(gprs, gprs + 16, header.gprs);
+  copy(csrs, csrs + 16, header.csrs);
+  header.csrs[COREID_CSR] = 0;
+  header.timerConfig = timerConfig;
+  header.instructionCount = instructionCount;
+  header.timerRemaining = timerDeadline == UINT64_MAX ? UINT64_MAX : timerDeadline - instructionCount;
+  // the statistics and debugger requests belong to this run, a restore without gdb would never clear them
+  header.pendingInterrupts = pendingInterrupts.load() & (TIMER_INTERRUPT | TERMINAL_INTERRUPT | SOFTWARE_INTERRUPT | DMA_INTERRUPT);
+
+  uint32_t head = terminalHead.load(memory_order_relaxed);
+  uint32_t tail = terminalTail.load(memory_order_acquire);
+  header.terminalCount = tail - head;
+  for(uint32_t i = 0; i < header.terminalCount; i++) header.terminal[i] = terminalBuffer[(head + i) % TERMINAL_BUFFER_SIZE];
+  header.pageCount = pages.size();
+
+  ofstream file(fileName, ios::binary);
+  if(!file.is_open()) return false;
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(pages.data()), pages.size() * sizeof(uint32_t));
+  vector<char> padding(pagesOffset(pages.size()) - sizeof(header) - pages.size() * sizeof(uint32_t), 0);
+  file.write(padding.data(), padding.size());
+  for(uint32_t address : pages) file.write(reinterpret_cast<const char *>(memory.pointer(address)), Memory::PAGE_SIZE);
+
+  return file.good();
+}
+
+// The pages of the file are mapped privately in place of the guest pages, they are read from it on first use
+// and copied on first write; pages that follow each other in memory and in the file are mapped together
+bool Emulator::restoreCheckpoint(const string &fileName) {
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+
+  struct stat info;
+  if(!memory.valid() || fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) < sizeof(checkpointHeader)) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = info.st_size;
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(mapped == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  uint8_t *base = static_cast<uint8_t *>(mapped);
+  checkpointHeader header;
+  memcpy(&header, base, sizeof(header));
+  bool valid = memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0 && header.terminalCount <= TERMINAL_BUFFER_SIZE &&
+               header.pageCount <= (size - sizeof(header)) / Memory::PAGE_SIZE && pagesOffset(header.pageCount) + static_cast<size_t>(header.pageCount) * Memory::PAGE_SIZE <= size;
+
+  const uint32_t *pages = reinterpret_cast<const uint32_t *>(base + sizeof(header));
+  for(uint32_t i = 0, run; valid && i < header.pageCount; i += run) {
+    for(run = 1; i + run < header.pageCount && pages[i + run] == pages[i] + run * Memory::PAGE_SIZE; run++);
+    valid = !(pages[i] & Memory::PAGE_MASK) &&
+            memory.mapFile(fd, pagesOffset(header.pageCount) + static_cast<size_t>(i) * Memory::PAGE_SIZE, pages[i], static_cast<size_t>(run) * Memory::PAGE_SIZE);
+  }
+  munmap(mapped, size);
+  close(fd);
+  if(!valid) return false;
+
+  copy(header.gprs, header.gprs + 16, gprs);
+  for(int i = 0; i < 16; i++) {
+    if(i != COREID_CSR) csrs[i] = header.csrs[i];
+  }
+  statusChanged();
+  timerConfig = header.timerConfig;
+  instructionCount = header.instructionCount;
+  timerDeadline = header.timerRemaining == UINT64_MAX ? UINT64_MAX : instructionCount + header.timerRemaining;
+  pendingInterrupts = header.pendingInterrupts;
+
+  // the terminal thread isn't running yet
+  for(uint32_t i = 0; i < header.terminalCount; i++) terminalBuffer[i] = header.terminal[i];
+  terminalHead = 0;
+  terminalTail = header.terminalCount;
+
+  imageBytes = size;
+  return true;
+}
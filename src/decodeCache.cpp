@@ -0,0 +1,184 @@
+#include "./../inc/decodeCache.hpp"
+
+DecodeCache::DecodeCache() : entries(1 << CACHE_BITS), codePages(1 << (32 - PAGE_BITS), false) {
+  clear();
+}
+
+DecodeCache::decodedInstruction DecodeCache::decode(uint32_t pc, uint32_t instruction) {
+  uint8_t OC = (instruction >> 28) & 0xF;
+  uint8_t MOD = (instruction >> 24) & 0xF;
+  uint8_t A = (instruction >> 20) & 0xF;
+  uint8_t B = (instruction >> 16) & 0xF;
+  uint8_t C = (instruction >> 12) & 0xF;
+  int32_t D = instruction & 0xFFF;
+  if(D & 0x800) D |= 0xFFFFF000;
+
+  bool known;
+  switch(OC) {
+    case 0:
+      known = instruction == 0;
+      break;
+    case 1:
+      known = !MOD && !A && !B && !C && !D;
+      break;
+    case 2:
+      known = !C && MOD <= 1;
+      break;
+    case 3:
+      known = (MOD & 0x7) <= 3;
+      break;
+    case 4:
+      known = !MOD && !A && !D;
+      break;
+    case 5:
+    case 6:
+      known = !D && MOD <= 3;
+      break;
+    case 7:
+      known = !D && MOD <= 1;
+      break;
+    case 8:
+      known = MOD <= 2;
+      break;
+    case 9:
+      known = MOD <= 7;
+      break;
+    default:
+      known = false;
+      break;
+  }
+
+  uint8_t op = known ? (OC << 4 | MOD) : UNKNOWN;
+  return {pc, D, op, A, B, C, true, 4, OC};
+}
+
+DecodeCache::decodedInstruction *DecodeCache::insert(uint32_t pc, uint32_t instruction) {
+  uint32_t slot = (pc >> 2) & CACHE_MASK;
+  decodedInstruction &entry = entries[slot];
+
+  for(uint32_t page : {pc >> PAGE_BITS, (pc + 3) >> PAGE_BITS}) {
+    // a valid entry from the same page means that the slot is already on the page list
+    bool listed = entry.valid && (entry.pc >> PAGE_BITS == page || lastPage(entry) == page);
+    codePages[page] = true;
+    if(!listed) pageSlots[page].push_back(slot);
+  }
+
+  entry = specialize(decode(pc, instruction));
+  if(!breakpoints.empty() && breakpoints.count(pc)) entry.op = BREAKPOINT;
+  return &entry;
+}
+
+// Writes to r0 and the other instructions without an effect become NOP and loads into pc get their own ops,
+// so that the handlers of the interpreter don't test the registers; the jit translates what decode returns
+DecodeCache::decodedInstruction DecodeCache::specialize(decodedInstruction entry) {
+  uint8_t op = entry.op;
+  bool gprDestination = (op >= 0x50 && op <= 0x53) || (op >= 0x60 && op <= 0x63) || op == 0x70 || op == 0x71 || op == 0x81 || (op >= 0x90 && op <= 0x93);
+
+  if((gprDestination && entry.A == 0) || ((op == 0x93 || op == 0x97) && entry.B == 0) || (op == 0x40 && (entry.B == 0 || entry.C == 0))) entry.op = NOP;
+  else if(op == 0x92 && entry.A == 15) entry.op = LD_PC;
+  else if(op == 0x93 && entry.A == 15) entry.op = LD_PC_POST;
+  return entry;
+}
+
+// next are the three words after the entry, the literal is taken from them and the entry is dropped when they are written to:
+//   ld $lit, %gpr     ld %gpr, [pc + 4]; jmp pc + 4; lit
+//   ld lit, %gpr      ld %gpr, [pc + 8]; ld %gpr, [%gpr]; jmp pc + 4; lit
+//   st %gpr, lit      st [[pc + 4]], %gpr; jmp pc + 4; lit
+//   jmp lit           jmp [pc]; lit
+//   call lit          call [pc + 4]; jmp pc + 4; lit, the jmp runs after the return
+//   beq ..., lit      beq %gpr, %gpr, [pc + 4]; jmp pc + 4; lit, and the same for bne and bgt
+bool DecodeCache::fuse(decodedInstruction *entry, const uint32_t *next) {
+  static const uint32_t JMP_NEXT = 0x30F00004;
+  uint8_t op = entry->op;
+  uint8_t A = entry->A;
+  uint8_t B = entry->B;
+  uint8_t C = entry->C;
+  int32_t D = entry->D;
+
+  uint8_t fused;
+  uint32_t literal;
+  uint8_t size;
+  if(op == 0x92 && B == 15 && C == 0 && D == 4 && A != 0 && A != 15 && next[0] == JMP_NEXT) {
+    fused = LD_LITERAL;
+    literal = next[1];
+    size = 12;
+  } else if(op == 0x92 && B == 15 && C == 0 && D == 8 && A != 0 && A != 15 && next[0] == (0x92000000u | A << 20 | A << 16) && next[1] == JMP_NEXT) {
+    fused = LD_MEMORY_LITERAL;
+    literal = next[2];
+    size = 16;
+  } else if(op == 0x82 && A == 15 && B == 0 && D == 4 && next[0] == JMP_NEXT) {
+    fused = ST_MEMORY_LITERAL;
+    literal = next[1];
+    size = 12;
+  } else if(op == 0x38 && A == 15 && D == 0) {
+    fused = JMP_LITERAL;
+    literal = next[0];
+    size = 8;
+  } else if(op == 0x21 && A == 15 && B == 0 && D == 4) {
+    fused = CALL_LITERAL;
+    literal = next[1];
+    size = 12;
+  } else if(op >= 0x39 && op <= 0x3B && A == 15 && D == 4 && next[0] == JMP_NEXT) {
+    fused = BEQ_LITERAL + (op - 0x39);
+    literal = next[1];
+    size = 12;
+  } else {
+    return false;
+  }
+
+  entry->op = fused;
+  entry->D = static_cast<int32_t>(literal);
+  entry->size = size;
+
+  uint32_t page = lastPage(*entry);
+  if(page != (entry->pc + 3) >> PAGE_BITS) {
+    codePages[page] = true;
+    pageSlots[page].push_back((entry->pc >> 2) & CACHE_MASK);
+  }
+  return true;
+}
+
+void DecodeCache::invalidatePage(uint32_t page) {
+  for(uint32_t slot : pageSlots[page]) {
+    decodedInstruction &entry = entries[slot];
+    if(entry.valid && (entry.pc >> PAGE_BITS == page || lastPage(entry) == page)) entry.valid = false;
+  }
+  pageSlots.erase(page);
+  codePages[page] = false;
+}
+
+// whole pages are dropped, the range may be a block copy of the host
+void DecodeCache::invalidateRange(uint32_t address, size_t size) {
+  if(!size) return;
+  uint64_t last = (static_cast<uint64_t>(address) + size - 1) >> PAGE_BITS;
+  for(uint64_t page = address >> PAGE_BITS; page <= last; page++) {
+    if(codePages[page]) invalidatePage(page);
+  }
+}
+
+void DecodeCache::setBreakpoint(uint32_t pc, bool set) {
+  if(set) breakpoints.insert(pc);
+  else breakpoints.erase(pc);
+  decodedInstruction *entry = find(pc);
+  if(entry) entry->valid = false;
+}
+
+void DecodeCache::clearBreakpoints() {
+  for(uint32_t pc : breakpoints) {
+    decodedInstruction *entry = find(pc);
+    if(entry) entry->valid = false;
+  }
+  breakpoints.clear();
+}
+
+void DecodeCache::clear() {
+  for(auto &entry : entries) entry.valid = false;
+  for(auto &page : pageSlots) codePages[page.first] = false;
+  pageSlots.clear();
+}
+
+vector<uint32_t> DecodeCache::pages() const {
+  vector<uint32_t> result;
+  for(auto &page : pageSlots) result.push_back(page.first);
+  return result;
+}
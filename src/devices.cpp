@@ -0,0 +1,24 @@
+#include "./../inc/devices.hpp"
+
+#include <algorithm>
+
+// false if the range is empty or overlaps a region that is already there
+bool DeviceRegistry::add(const string &name, uint32_t start, uint32_t end, readCallback read, writeCallback write) {
+  if(end < start) return false;
+  for(auto &region : regions) {
+    if(start <= region.end && end >= region.start) return false;
+  }
+
+  auto position = find_if(regions.begin(), regions.end(), [start](const deviceRegion &region) { return region.start > start; });
+  regions.insert(position, {name, start, end, read, write});
+  firstRegionAccess = min(firstRegionAccess, start < 3 ? 0 : start - 3);
+  firstAccess = min(firstAccess, firstRegionAccess);
+  return true;
+}
+
+const DeviceRegistry::deviceRegion *DeviceRegistry::find(uint32_t address) const {
+  for(auto &region : regions) {
+    if(address <= region.end && (address > UINT32_MAX - 3 || address + 3 >= region.start)) return &region;
+  }
+  return nullptr;
+}
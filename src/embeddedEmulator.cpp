@@ -0,0 +1,89 @@
+#include "./../inc/embeddedEmulator.hpp"
+
+#include <cstring>
+
+emulatorOptions EmbeddedEmulator::defaultOptions() {
+  emulatorOptions options;
+  options.headless = true;
+  options.virtualTime = true;
+  return options;
+}
+
+EmbeddedEmulator::EmbeddedEmulator(emulatorOptions options) {
+  // one core, the host thread is the processor
+  options.cores = 1;
+  options.embedded = true;
+  char name[] = "";
+  emulator.reset(new Emulator(name, options));
+}
+
+bool EmbeddedEmulator::loadHex(const char *image, size_t size) {
+  return emulator->hexParse(reinterpret_cast<const uint8_t *>(image), size);
+}
+
+bool EmbeddedEmulator::loadCheckpoint(const string &fileName) {
+  return emulator->restoreCheckpoint(fileName);
+}
+
+// the timer thread or the terminal thread only start when the options don't have virtual time or aren't headless
+void EmbeddedEmulator::begin(uint64_t instructions) {
+  Emulator &e = *emulator;
+  if(!started) {
+    e.startDevices();
+    started = true;
+  }
+
+  e.idleStopped = e.stopRequested = false;
+  e.pauseAt = min(e.options.maxInstructions, e.instructionCount + min(instructions, UINT64_MAX - e.instructionCount));
+  e.updateDeadline();
+}
+
+EmbeddedEmulator::runResult EmbeddedEmulator::run(uint64_t instructions) {
+  if(emulator->halted) return HALTED;
+  begin(instructions);
+
+  emulator->run();
+  return finish(false);
+}
+
+EmbeddedEmulator::runResult EmbeddedEmulator::runUntil(const function<bool(EmbeddedEmulator &)> &condition, uint64_t instructions) {
+  if(emulator->halted) return HALTED;
+  begin(instructions);
+
+  while(emulator->step()) {
+    if(condition(*this)) return finish(true);
+  }
+  return finish(false);
+}
+
+EmbeddedEmulator::runResult EmbeddedEmulator::finish(bool conditionMet) {
+  Emulator &e = *emulator;
+  e.pauseAt = UINT64_MAX;
+  e.updateDeadline();
+  if(conditionMet) return CONDITION_MET;
+  if(e.halted) return HALTED;
+  if(e.idleStopped) return IDLE;
+  return BUDGET_USED;
+}
+
+bool EmbeddedEmulator::setGpr(int index, uint32_t value) {
+  if(index <= 0 || index >= 16) return false;
+  emulator->gprs[index] = value;
+  return true;
+}
+
+bool EmbeddedEmulator::setCsr(int index, uint32_t value) {
+  if(index < 0 || index >= 16 || index == Emulator::COREID_CSR) return false;
+  emulator->csrs[index] = value;
+  emulator->statusChanged();
+  return true;
+}
+
+void EmbeddedEmulator::read(uint32_t address, void *bytes, size_t size) const {
+  uint8_t *to = static_cast<uint8_t *>(bytes);
+  for(size_t i = 0; i < size; i++) to[i] = emulator->memory.read8(address + i);
+}
+
+void EmbeddedEmulator::write(uint32_t address, const void *bytes, size_t size) {
+  emulator->hostWrite(address, static_cast<const uint8_t *>(bytes), size);
+}
@@ -1,396 +1,1200 @@
 #include "./../inc/emulator.hpp"
 
 #include <iostream>
-#include <fstream>
 #include <sstream>
 #include <string>
-#include <map>
 #include <iomanip>
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <cerrno>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <csignal>
+#include <pthread.h>
 
-Emulator::Emulator(char *inputFile) : gprs(16, 0), csrs(3, 0) {
+Emulator::Emulator(char *inputFile, emulatorOptions options) : machine(this), ownMemory(new Memory()), memory(*ownMemory), ownDevices(new DeviceRegistry()), devices(*ownDevices), jit(this, gprs, &pendingInterrupts) {
   inputFileName = string(inputFile);
+  this->options = options;
   gprs[15] = 0x40000000;
+  // before the trace writer, the first thread the emulator starts
+  if(!options.stats.empty()) blockStatsSignal();
+  if(!options.profile.empty()) profiler.reset(new Profiler(gprs[15]));
+  if(!options.trace.empty()) tracer.reset(new Tracer(options.trace));
+  if(!options.gdb.empty()) debugger.reset(new GdbStub(this, options.gdb));
+  if(options.icache.size || options.dcache.size) caches.reset(new CacheModel(options.icache, options.dcache));
+  stats = !options.stats.empty();
+  countAccesses = stats || caches;
+  fusion = options.fusion && !profiler && !tracer && !stats && !debugger && !caches;
+  slowFetch = profiler || tracer || stats || caches;
+  if(options.headless) out = &captured;
+  addDevices();
+}
 
-  timerThread = thread(&Emulator::emulatingTimer, this);
-
-  sem_init(&mutex, 0, 1);
+// a core of machine, it has its own registers and caches and no devices
+Emulator::Emulator(Emulator *machine, uint32_t coreId) : machine(machine), coreId(coreId), multiCore(true), memory(machine->memory), devices(machine->devices), jit(this, gprs, &pendingInterrupts) {
+  inputFileName = machine->inputFileName;
+  options = machine->options;
+  out = machine->out;
+  gprs[15] = 0x40000000;
+  csrs[COREID_CSR] = coreId;
+  if(!options.trace.empty()) tracer.reset(new Tracer(options.trace + "." + to_string(coreId)));
+  stats = !options.stats.empty();
+  countAccesses = stats;
+  fusion = options.fusion && !tracer && !stats;
+  slowFetch = true;
+  stopAt = options.maxInstructions;
+  updateDeadline();
 }
 
 Emulator::~Emulator() {
   end = true;
-  if(timerThread.joinable()) timerThread.join();
+  if(timerThread.joinable()) {
+    {
+      lock_guard<mutex> lock(timerMutex);
+    }
+    timerWakeup.notify_one();
+    timerThread.join();
+  }
+  if(statsThread.joinable()) {
+    pthread_kill(statsThread.native_handle(), SIGUSR1);
+    statsThread.join();
+  }
 
-  sem_destroy(&mutex);
+  if(terminalThread.joinable()) {
+    char wake = 0;
+    write(terminalWakeFds[1], &wake, 1);
+    terminalThread.join();
+    close(terminalWakeFds[0]);
+    close(terminalWakeFds[1]);
+  }
 }
 
 void Emulator::emulate() {
-  hexRead();
-  emulatingInstructions();
+  if(!memory.valid()) {
+    *out << "Unable to reserve the guest address space" << endl;
+    return;
+  }
+
+  auto loadStart = chrono::steady_clock::now();
+  if(options.restoreFile.empty()) {
+    hexRead();
+  } else if(!restoreCheckpoint(options.restoreFile)) {
+    *out << "Unable to restore the checkpoint " << options.restoreFile << endl;
+    return;
+  }
+  chrono::duration<double> loadTime = chrono::steady_clock::now() - loadStart;
+
+  if(!options.saveFile.empty()) checkpointAt = options.saveAt;
+  stopAt = options.maxInstructions;
+  updateDeadline();
+
+  if(tracer && !tracer->good()) {
+    *out << "Unable to write the trace " << options.trace << endl;
+    return;
+  }
+
+  if(stats) startStatsSignal();
+  if(debugger) {
+    if(!debugger->listen()) {
+      *out << "Unable to listen for gdb on " << options.gdb << endl;
+      return;
+    }
+    *out << "Waiting for gdb on " << options.gdb << endl;
+    if(!debugger->accept()) {
+      *out << "Unable to accept gdb on " << options.gdb << endl;
+      return;
+    }
+    debugAt = instructionCount;
+    updateDeadline();
+  }
+  startDevices();
+  if(!options.headless) {
+    setRawMode(true);
+    setNonBlocking(true);
+  }
+
+  if(options.cores > 1) {
+    multiCore = true;
+    slowFetch = true;
+    codeOwners.reset(new atomic<uint32_t>[1 << (32 - Memory::PAGE_BITS)]());
+    for(uint32_t id = 1; id < options.cores; id++) cores.push_back(unique_ptr<Emulator>(new Emulator(this, id)));
+  }
+
+  runStart = chrono::steady_clock::now();
+  vector<thread> coreThreads;
+  for(auto &other : cores) coreThreads.push_back(thread(&Emulator::run, other.get()));
+  run();
+  for(auto &coreThread : coreThreads) coreThread.join();
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - runStart;
+  if(debugger) debugger->exited();
+
+  if(!options.headless) {
+    setRawMode(false);
+    setNonBlocking(false);
+  }
+
   printState();
+  for(auto &other : cores) other->printState();
+  if(profiler && !profiler->write(options.profile, memory)) *out << "Unable to write the profile" << endl;
+  if(tracer && !tracer->finish()) *out << "Unable to write the trace " << options.trace << endl;
+  if(caches && !caches->write(options.cacheReport, memory)) *out << "Unable to write the cache report " << options.cacheReport << endl;
+  for(auto &other : cores) {
+    if(other->tracer && !other->tracer->finish()) *out << "Unable to write the trace of core " << other->coreId << endl;
+  }
+  if(stats && !writeStats(false)) *out << "Unable to write the statistics " << options.stats << endl;
+  if(options.mips) {
+    *out << "Loaded " << dec << imageBytes << " bytes of image in " << fixed << setprecision(3) << loadTime.count() << " s" << endl;
+    printMips(elapsed.count());
+  }
+  if(options.footprint) printFootprint();
 }
 
-void Emulator::hexRead() {
-  ifstream file(inputFileName);
+// The devices start after the load, a restored checkpoint brings their state with it,
+// the timer thread starts on the first store to TIM_CFG
+void Emulator::startDevices() {
+  if(!options.virtualTime && getTimerPeriod(timerConfig) > 0 && !timerThread.joinable()) startTimer();
+  if(!options.headless && !terminalThread.joinable() && pipe(terminalWakeFds) == 0) {
+    terminalOpen = true;
+    terminalThread = thread(&Emulator::emulatingTerminal, this);
+  }
+}
+
+// value of every character as a hex digit, -1 if it isn't one
+static struct hexTable {
+  int8_t values[256];
+
+  hexTable() {
+    for(int i = 0; i < 256; i++) values[i] = -1;
+    for(int i = 0; i < 10; i++) values['0' + i] = i;
+    for(int i = 0; i < 6; i++) values['a' + i] = values['A' + i] = 10 + i;
+  }
+} hexDigitTable;
+
+// The image is mapped and parsed in place
+bool Emulator::hexRead() {
+  int fd = open(inputFileName.c_str(), O_RDONLY);
+  struct stat info;
+  if(fd < 0 || fstat(fd, &info) < 0) {
+    if(fd >= 0) close(fd);
+    *out << "Unable to open file";
+    return false;
+  }
+
+  imageBytes = 0;
+  size_t size = info.st_size;
+  if(size == 0) {
+    close(fd);
+    return true;
+  }
+
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapped == MAP_FAILED) {
+    *out << "Unable to open file";
+    return false;
+  }
+  madvise(mapped, size, MADV_SEQUENTIAL);
+
+  bool parsed = hexParse(static_cast<const uint8_t *>(mapped), size);
+  munmap(mapped, size);
+  return parsed;
+}
+
+// Bytes of consecutive lines are gathered and copied into memory together
+bool Emulator::hexParse(const uint8_t *p, size_t size) {
+  if(!memory.valid()) {
+    *out << "Unable to reserve the guest address space";
+    return false;
+  }
+  const uint8_t *end = p + size;
+  const int8_t *hexDigits = hexDigitTable.values;
 
-  if(file.is_open()) {
-    string line;
-    while(getline(file, line)) {
-      if(line.empty()) continue;
+  static const size_t BLOCK_SIZE = 64 << 10;
+  vector<uint8_t> block;
+  block.reserve(BLOCK_SIZE + 8);
+  uint32_t blockStart = 0;
 
-      stringstream ss(line.substr(0, 10));
-      uint32_t address;
-      ss >> hex >> address;
+  while(p < end) {
+    uint32_t address = 0;
+    while(p < end && hexDigits[*p] >= 0) address = address << 4 | hexDigits[*p++];
+    if(p < end && *p == ':') p++;
 
-      string dataStr = line.substr(10);
-      for(int i = 0; i < dataStr.length(); i += 3) {
-        string byteStr = dataStr.substr(i, 2);
-        uint8_t byte = stoi(byteStr, nullptr, 16);
-        memory[address++] = byte;
+    if(address != blockStart + block.size() || block.size() >= BLOCK_SIZE) {
+      memory.writeBlock(blockStart, block.data(), block.size());
+      block.clear();
+      blockStart = address;
+    }
+
+    // lines written by the linker are 8 times " xx", the rest of the line is taken a byte at a time
+    if(end - p >= 24 && p[0] == ' ' && p[3] == ' ' && p[6] == ' ' && p[9] == ' ' && p[12] == ' ' && p[15] == ' ' && p[18] == ' ' && p[21] == ' ') {
+      int8_t digits[16];
+      for(int i = 0; i < 8; i++) {
+        digits[2 * i] = hexDigits[p[3 * i + 1]];
+        digits[2 * i + 1] = hexDigits[p[3 * i + 2]];
+      }
+      int8_t invalid = 0;
+      for(int i = 0; i < 16; i++) invalid |= digits[i];
+      if(invalid >= 0) {
+        for(int i = 0; i < 8; i++) block.push_back(digits[2 * i] << 4 | digits[2 * i + 1]);
+        p += 24;
       }
     }
-    file.close();
-  } else {
-    cout << "Unable to open file";
+
+    while(p < end && *p != '\n') {
+      if(end - p >= 2 && hexDigits[p[0]] >= 0 && hexDigits[p[1]] >= 0) {
+        block.push_back(hexDigits[p[0]] << 4 | hexDigits[p[1]]);
+        p += 2;
+      } else {
+        p++;
+      }
+    }
+    if(p < end) p++;
+  }
+  memory.writeBlock(blockStart, block.data(), block.size());
+
+  imageBytes = size;
+  return true;
+}
+
+void Emulator::run() {
+  if(tracer && options.engine != SWITCH_ENGINE) {
+    if(coreId == 0) *out << "Traces are recorded by the switch engine" << endl;
+    emulatingInstructions();
+  } else if(options.engine == THREADED_ENGINE) threadedInstructions();
+  else if(options.engine == JIT_ENGINE && !multiCore) jitInstructions();
+  else if(options.engine == JIT_ENGINE) {
+    if(coreId == 0) *out << "Translated code isn't shared between cores, using the threaded engine" << endl;
+    threadedInstructions();
+  } else emulatingInstructions();
+}
+
+// fetch without a hit in the decode cache, or with more to do than the hit
+DecodeCache::decodedInstruction *Emulator::fetchSlow() {
+  if(multiCore && dropDecoded.load(memory_order_acquire)) dropDecodedInstructions();
+  DecodeCache::decodedInstruction *decoded = decodeCache.find(gprs[15]);
+  if(!decoded) {
+    // instruction words aren't counted as memory reads
+    uint32_t pc = gprs[15];
+    decoded = decodeCache.insert(pc, devices.mayHit(pc) ? deviceRead(pc) : memory.read32(pc));
+    // the words of an idiom are read from memory, never from a device
+    if(fusion && DecodeCache::fusable(decoded) && pc <= UINT32_MAX - 15 && !devices.mayHit(pc + 12)) {
+      uint32_t next[3] = {memory.read32(pc + 4), memory.read32(pc + 8), memory.read32(pc + 12)};
+      decodeCache.fuse(decoded, next);
+    }
+    if(multiCore) ownCode(decoded);
   }
+  if(profiler) profiler->count(gprs[15]);
+  if(caches) caches->fetch(gprs[15]);
+  if(tracer) tracer->instruction(gprs[15], memory.read32(gprs[15]));
+  if(stats) counters[OPCODES + min<uint32_t>(decoded->OC, OPCODE_GROUPS - 1)]++;
+  return decoded;
 }
 
 void Emulator::emulatingInstructions() {
-  uint32_t instruction;
   bool end = false;
-
-  setRawMode(true);
-  setNonBlocking(true);
   
   while(!end) {
-    sem_wait(&mutex);
-    
-    emulatingTerminal();
+    if(eventsDue() && !handleInterrupts()) break;
 
-    instruction = read4Bytes(gprs[15]);
-    gprs[15] = gprs[15] + 4;
-    uint8_t OC = (instruction >> 28) & 0xF;
-    uint8_t MOD = (instruction >> 24) & 0xF;
-    uint8_t A = (instruction >> 20) & 0xF;
-    uint8_t B = (instruction >> 16) & 0xF;
-    uint8_t C = (instruction >> 12) & 0xF;
-    int32_t D = instruction & 0xFFF;
-    if(D & 0x800) D |= 0xFFFFF000;
-
-    switch(OC) {
-      case 0:
-        if(instruction == 0) {
-          end = true;
-        } else cout << "UNKNOWN INSTRUCTION" << endl;
-        break;
-      case 1:
-        if(!MOD && !A && !B && !C && !D) interrupt();
-        else cout << "UNKNOWN INSTRUCTION" << endl;
-        break;
-      case 2:
-        if(!C) call(MOD, A, B, D);
-        else cout << "UNKNOWN INSTRUCTION" << endl;
-        break;
-      case 3:
-        jump(MOD, A, B, C, D);
-        break;
-      case 4:
-        if(!MOD && !A && !D) xchg(B, C);
-        else cout << "UNKNOWN INSTRUCTION" << endl;
-        break;
-      case 5:
-        if(!D) arit(MOD, A, B, C);
-        else cout << "UNKNOWN INSTRUCTION" << endl;
-        break;
-      case 6:
-        if(!D) log(MOD, A, B, C);
-        else cout << "UNKNOWN INSTRUCTION" << endl;
-        break;
-      case 7:
-        if(!D) shift(MOD, A, B, C);
-        else cout << "UNKNOWN INSTRUCTION" << endl;
-        break;
-      case 8:
-        st(MOD, A, B, C, D);
-        break;
-      case 9:
-        ld(MOD, A, B, C, D);
-        break;
-      default:
-        cout << "UNKNOWN INSTRUCTION" << endl;
-        break;
-    }
-    sem_post(&mutex);
+    end = !execute(fetch());
+  }
+}
+
+// Same instruction semantics as emulatingInstructions, dispatched with computed goto to one handler per op of the decode cache
+void Emulator::threadedInstructions() {
+  void *handlers[256];
+  for(int i = 0; i < 256; i++) handlers[i] = &&op_unknown;
+  handlers[0x00] = &&op_halt;
+  handlers[0x10] = &&op_int;
+  handlers[0x20] = &&op_call_reg;
+  handlers[0x21] = &&op_call_mem;
+  handlers[0x30] = &&op_jmp;
+  handlers[0x31] = &&op_beq;
+  handlers[0x32] = &&op_bne;
+  handlers[0x33] = &&op_bgt;
+  handlers[0x38] = &&op_jmp_mem;
+  handlers[0x39] = &&op_beq_mem;
+  handlers[0x3A] = &&op_bne_mem;
+  handlers[0x3B] = &&op_bgt_mem;
+  handlers[0x40] = &&op_xchg;
+  handlers[0x50] = &&op_add;
+  handlers[0x51] = &&op_sub;
+  handlers[0x52] = &&op_mul;
+  handlers[0x53] = &&op_div;
+  handlers[0x60] = &&op_not;
+  handlers[0x61] = &&op_and;
+  handlers[0x62] = &&op_or;
+  handlers[0x63] = &&op_xor;
+  handlers[0x70] = &&op_shl;
+  handlers[0x71] = &&op_shr;
+  handlers[0x80] = &&op_st;
+  handlers[0x81] = &&op_st_pre;
+  handlers[0x82] = &&op_st_mem;
+  handlers[0x90] = &&op_csrrd;
+  handlers[0x91] = &&op_ld_reg;
+  handlers[0x92] = &&op_ld;
+  handlers[0x93] = &&op_ld_post;
+  handlers[0x94] = &&op_csrwr;
+  handlers[0x95] = &&op_csr_csr;
+  handlers[0x96] = &&op_csr_ld;
+  handlers[0x97] = &&op_csr_ld_post;
+  handlers[0xA0] = &&op_ld_literal;
+  handlers[0xA1] = &&op_ld_memory_literal;
+  handlers[0xA2] = &&op_st_memory_literal;
+  handlers[0xA3] = &&op_jmp_literal;
+  handlers[0xA4] = &&op_call_literal;
+  handlers[0xA5] = &&op_beq_literal;
+  handlers[0xA6] = &&op_bne_literal;
+  handlers[0xA7] = &&op_bgt_literal;
+  handlers[0xB0] = &&op_nop;
+  handlers[0xB2] = &&op_ld_pc;
+  handlers[0xB3] = &&op_ld_pc_post;
+  handlers[0xB4] = &&op_breakpoint;
+
+  DecodeCache::decodedInstruction *decoded;
+  uint8_t A, B, C;
+  int32_t D;
+
+#define DISPATCH() \
+  if(eventsDue() && !handleInterrupts()) return; \
+  decoded = fetch(); \
+  A = decoded->A; \
+  B = decoded->B; \
+  C = decoded->C; \
+  D = decoded->D; \
+  goto *handlers[decoded->op]
+
+#define JUMPED() \
+  if(gprs[15] < decoded->pc + 4) idleCheck()
+
+// the second instruction of a literal idiom is run with the first one unless that would pass the next event
+#define FUSED_NEXT(size) \
+  if(instructionCount < eventDeadline) { \
+    gprs[15] = decoded->pc + size; \
+    instructionCount++; \
+    fusedCounts[decoded->op & 0xF]++; \
+    fusedInstructions += 2; \
   }
 
-  setRawMode(false);
-  setNonBlocking(false);
+#define BRANCH_LITERAL(condition) \
+  if(condition) { \
+    gprs[15] = D; \
+    fusedCounts[decoded->op & 0xF]++; \
+    fusedInstructions++; \
+    JUMPED(); \
+  } else { \
+    FUSED_NEXT(12); \
+  }
+
+  if(eventsDue() && !handleInterrupts()) return;
+  decoded = fetch();
+  A = decoded->A;
+  B = decoded->B;
+  C = decoded->C;
+  D = decoded->D;
+  goto *handlers[decoded->op];
+
+op_halt:
+  halted = true;
+  return;
+op_int:
+  interrupt();
+  DISPATCH();
+op_call_reg:
+  gprs[14] = gprs[14] - 4;
+  write4Bytes(gprs[14], gprs[15]);
+  gprs[15] = gprs[A] + gprs[B] + D;
+  if(profiler) profiler->call(gprs[15]);
+  DISPATCH();
+op_call_mem:
+  gprs[14] = gprs[14] - 4;
+  write4Bytes(gprs[14], gprs[15]);
+  gprs[15] = read4Bytes(gprs[A] + gprs[B] + D);
+  if(profiler) profiler->call(gprs[15]);
+  DISPATCH();
+op_jmp:
+  gprs[15] = gprs[A] + D;
+  JUMPED();
+  DISPATCH();
+op_beq:
+  if(gprs[B] == gprs[C]) gprs[15] = gprs[A] + D;
+  JUMPED();
+  DISPATCH();
+op_bne:
+  if(gprs[B] != gprs[C]) gprs[15] = gprs[A] + D;
+  JUMPED();
+  DISPATCH();
+op_bgt:
+  if((int) gprs[B] > (int) gprs[C]) gprs[15] = gprs[A] + D;
+  JUMPED();
+  DISPATCH();
+op_jmp_mem:
+  gprs[15] = read4Bytes(gprs[A] + D);
+  JUMPED();
+  DISPATCH();
+op_beq_mem:
+  if(gprs[B] == gprs[C]) gprs[15] = read4Bytes(gprs[A] + D);
+  JUMPED();
+  DISPATCH();
+op_bne_mem:
+  if(gprs[B] != gprs[C]) gprs[15] = read4Bytes(gprs[A] + D);
+  JUMPED();
+  DISPATCH();
+op_bgt_mem:
+  if((int) gprs[B] > (int) gprs[C]) gprs[15] = read4Bytes(gprs[A] + D);
+  JUMPED();
+  DISPATCH();
+op_xchg:
+  swap(gprs[B], gprs[C]);
+  DISPATCH();
+op_add:
+  gprs[A] = gprs[B] + gprs[C];
+  DISPATCH();
+op_sub:
+  gprs[A] = gprs[B] - gprs[C];
+  DISPATCH();
+op_mul:
+  gprs[A] = gprs[B] * gprs[C];
+  DISPATCH();
+op_div:
+  gprs[A] = gprs[B] / gprs[C];
+  DISPATCH();
+op_not:
+  gprs[A] = ~gprs[B];
+  DISPATCH();
+op_and:
+  gprs[A] = gprs[B] & gprs[C];
+  DISPATCH();
+op_or:
+  gprs[A] = gprs[B] | gprs[C];
+  DISPATCH();
+op_xor:
+  gprs[A] = gprs[B] ^ gprs[C];
+  DISPATCH();
+op_shl:
+  gprs[A] = gprs[B] << gprs[C];
+  DISPATCH();
+op_shr:
+  gprs[A] = gprs[B] >> gprs[C];
+  DISPATCH();
+op_st:
+  write4Bytes(gprs[A] + gprs[B] + D, gprs[C]);
+  DISPATCH();
+op_st_pre:
+  gprs[A] = gprs[A] + D;
+  write4Bytes(gprs[A], gprs[C]);
+  DISPATCH();
+op_st_mem:
+  write4Bytes(read4Bytes(gprs[A] + gprs[B] + D), gprs[C]);
+  DISPATCH();
+op_csrrd:
+  gprs[A] = csrs[B];
+  DISPATCH();
+op_ld_reg:
+  gprs[A] = gprs[B] + D;
+  DISPATCH();
+op_ld:
+  gprs[A] = read4Bytes(gprs[B] + gprs[C] + D);
+  DISPATCH();
+op_ld_post:
+  gprs[A] = read4Bytes(gprs[B]);
+  gprs[B] = gprs[B] + D;
+  DISPATCH();
+op_ld_pc:
+  gprs[15] = read4Bytes(gprs[B] + gprs[C] + D);
+  if(profiler) profiler->ret();
+  DISPATCH();
+op_ld_pc_post:
+  gprs[15] = read4Bytes(gprs[B]);
+  gprs[B] = gprs[B] + D;
+  if(profiler) profiler->ret();
+  DISPATCH();
+op_csrwr:
+  writeCsr(A, gprs[B]);
+  DISPATCH();
+op_csr_csr:
+  writeCsr(A, csrs[B] + D);
+  DISPATCH();
+op_csr_ld:
+  writeCsr(A, read4Bytes(gprs[B] + gprs[C] + D));
+  DISPATCH();
+op_csr_ld_post: {
+  uint32_t value = read4Bytes(gprs[B]);
+  writeCsr(A, value);
+  gprs[B] = gprs[B] + D;
+  DISPATCH();
+}
+op_ld_literal:
+  gprs[A] = D;
+  gprs[15] = decoded->pc + 4;
+  FUSED_NEXT(12);
+  DISPATCH();
+op_jmp_literal:
+  gprs[15] = D;
+  fusedCounts[decoded->op & 0xF]++;
+  fusedInstructions++;
+  JUMPED();
+  DISPATCH();
+op_beq_literal:
+  gprs[15] = decoded->pc + 4;
+  BRANCH_LITERAL(gprs[B] == gprs[C]);
+  DISPATCH();
+op_bne_literal:
+  gprs[15] = decoded->pc + 4;
+  BRANCH_LITERAL(gprs[B] != gprs[C]);
+  DISPATCH();
+op_bgt_literal:
+  gprs[15] = decoded->pc + 4;
+  BRANCH_LITERAL((int) gprs[B] > (int) gprs[C]);
+  DISPATCH();
+op_ld_memory_literal:
+  fused<DecodeCache::LD_MEMORY_LITERAL & 0xF>(decoded->pc, A, B, C, D);
+  DISPATCH();
+op_st_memory_literal:
+  fused<DecodeCache::ST_MEMORY_LITERAL & 0xF>(decoded->pc, A, B, C, D);
+  DISPATCH();
+op_call_literal:
+  fused<DecodeCache::CALL_LITERAL & 0xF>(decoded->pc, A, B, C, D);
+  DISPATCH();
+op_nop:
+  DISPATCH();
+op_breakpoint:
+  if(!breakpoint(*decoded)) return;
+  DISPATCH();
+op_unknown:
+  *out << "UNKNOWN INSTRUCTION" << endl;
+  DISPATCH();
+
+#undef BRANCH_LITERAL
+#undef FUSED_NEXT
+#undef JUMPED
+#undef DISPATCH
+}
+
+// Translated blocks run between two checks of the devices, see Jit
+void Emulator::jitInstructions() {
+  if(profiler) {
+    *out << "Translated code isn't profiled, using the threaded engine" << endl;
+    threadedInstructions();
+    return;
+  }
+  if(stats) {
+    *out << "Translated code doesn't count memory accesses and opcodes, using the threaded engine" << endl;
+    threadedInstructions();
+    return;
+  }
+  if(caches) {
+    *out << "Translated code doesn't go through the cache model, using the threaded engine" << endl;
+    threadedInstructions();
+    return;
+  }
+  if(debugger) {
+    *out << "Translated code can't be debugged, using the threaded engine" << endl;
+    threadedInstructions();
+    return;
+  }
+
+  if(!jit.available()) {
+    *out << "Unable to allocate the code cache, using the switch engine" << endl;
+    emulatingInstructions();
+    return;
+  }
+
+  bool end = false;
+  uint32_t sampleInterval = 1;
+  uint32_t sampleCountdown = 1;
+
+  while(!end) {
+    if(eventsDue() && !handleInterrupts()) break;
+
+    uint64_t stores = storeCount;
+    Jit::exitCode result = jit.execute(gprs[15], instructionCount, eventDeadline - instructionCount);
+    // the instructions up to the next event are interpreted
+    if(result == Jit::SHORT_LIMIT) {
+      end = !execute(fetch());
+      continue;
+    }
+    end = result == Jit::HALT;
+    if(end) halted = true;
+
+    // jumps inside translated code are not seen by idleCheck, a run without stores may be an idle loop,
+    // so a few instructions are interpreted, the interval doubles every time that finds nothing
+    if(end || storeCount != stores || --sampleCountdown) continue;
+
+    uint64_t loops = idleLoops;
+    for(int i = 0; i < IDLE_SAMPLE && !end && !eventsDue(); i++) end = !execute(fetch());
+
+    sampleInterval = idleLoops != loops ? 1 : min(sampleInterval * 2, MAX_SAMPLE_INTERVAL);
+    sampleCountdown = sampleInterval;
+  }
 }
 
 void Emulator::printState() {
-  cout << "Emulated processor executed halt instruction\n";
-  cout << "Emulated processor state:\n";
-  
-  for(size_t i = 0; i < gprs.size(); ++i) {
+  // the instruction limit and the idle stop have printed their reason already
+  if(coreId == 0) {
+    *out << (halted ? "Emulated processor executed halt instruction\n" : "Emulated processor stopped\n");
+    *out << "Emulated processor state:\n";
+  } else {
+    *out << "Emulated core " << dec << coreId << " state:\n";
+  }
+
+  for(size_t i = 0; i < 16; ++i) {
     ostringstream oss;
     oss << "r" << dec << i << "=" << "0x" << setw(8) << setfill('0') << hex << gprs[i];
     string output = oss.str();
-    if(i % 4 == 0) cout << setw(14) << setfill(' ') << output;
-    else cout << setw(17) << setfill(' ') << output;
+    if(i % 4 == 0) *out << setw(14) << setfill(' ') << output;
+    else *out << setw(17) << setfill(' ') << output;
     if((i + 1) % 4 == 0) {
-      cout << endl;
+      *out << endl;
     }
   }
 }
 
+void Emulator::printMips(double seconds) {
+  uint64_t instructionCount = this->instructionCount;
+  for(auto &other : cores) instructionCount += other->instructionCount;
 
+  *out << "Executed " << dec << instructionCount << " instructions";
+  if(!cores.empty()) *out << " on " << cores.size() + 1 << " cores";
+  *out << " in " << fixed << setprecision(3) << seconds << " s";
+  if(seconds > 0 && instructionCount) {
+    *out << " (" << setprecision(2) << instructionCount / seconds / 1e6 << " MIPS, ";
+    *out << 1e9 * seconds / instructionCount << " ns per instruction)";
+  }
+  *out << endl;
+
+  uint64_t fusedCounts[DecodeCache::FUSED_OPS];
+  uint64_t fusedInstructions = this->fusedInstructions;
+  copy(this->fusedCounts, this->fusedCounts + DecodeCache::FUSED_OPS, fusedCounts);
+  for(auto &other : cores) {
+    fusedInstructions += other->fusedInstructions;
+    for(uint32_t i = 0; i < DecodeCache::FUSED_OPS; i++) fusedCounts[i] += other->fusedCounts[i];
+  }
+  if(fusedInstructions && instructionCount) {
+    static const char *names[DecodeCache::FUSED_OPS] = {"ld $lit", "ld lit", "st lit", "jmp", "call", "beq", "bne", "bgt"};
+    *out << "Fused literal idioms retired " << fusedInstructions << " instructions (" << setprecision(2);
+    *out << 100.0 * fusedInstructions / instructionCount << "% of all):";
+    for(uint32_t i = 0; i < DecodeCache::FUSED_OPS; i++) *out << " " << names[i] << " " << fusedCounts[i];
+    *out << endl;
+  }
+
+  if(!idleLoops) return;
+
+  // in real time the skipped instructions are estimated with the rate outside of the idle loops
+  uint64_t skipped = skippedInstructions;
+  if(idleSeconds > 0 && seconds > idleSeconds) skipped += static_cast<uint64_t>(instructionCount / (seconds - idleSeconds) * idleSeconds);
+  *out << "Skipped " << skipped << " instructions in " << idleLoops << " idle loops";
+  if(idleSeconds > 0) *out << " (" << setprecision(3) << idleSeconds << " s asleep)";
+  *out << endl;
+}
+
+// Touched pages less than REGION_GAP apart are counted as one region, pages that the guest only read
+// are touched without being resident
+void Emulator::printFootprint() {
+  static const uint32_t REGION_GAP = 1 << 20;
+  struct region {
+    uint32_t start;
+    uint32_t lastPage;
+    uint32_t pages;
+  };
+
+  vector<region> regions;
+  vector<uint32_t> pages = memory.touchedPages();
+  for(uint32_t page : pages) {
+    if(regions.empty() || page - regions.back().lastPage > REGION_GAP) regions.push_back({page, page, 0});
+    regions.back().lastPage = page;
+    regions.back().pages++;
+  }
+
+  *out << "Guest memory: " << dec << (memory.residentBytes() >> 10) << " KiB resident, " << pages.size() << " touched pages in ";
+  *out << regions.size() << " regions" << endl;
+  for(auto &touched : regions) {
+    *out << "  0x" << hex << setw(8) << setfill('0') << touched.start << "-0x" << setw(8) << touched.lastPage + Memory::PAGE_MASK;
+    *out << ": " << dec << touched.pages << (touched.pages == 1 ? " page" : " pages") << setfill(' ') << endl;
+  }
+}
+
+
+// int is a request like the others, the controller takes it before the next instruction, or once the handler
+// that masked it returns
 void Emulator::interrupt() {
-  if(!(csrs[0] & 0x4)) {
-    // push status; push pc; cause<=4; status<=status | 0x4; pc<=handler; 
+  pendingInterrupts.fetch_or(SOFTWARE_INTERRUPT);
+}
+
+// Called by the device threads
+void Emulator::postInterrupt(uint32_t request) {
+  pendingInterrupts.fetch_or(request);
+  notifyProcessor();
+}
+
+void Emulator::notifyProcessor() {
+  lock_guard<mutex> lock(idleMutex);
+  idleWakeup.notify_one();
+}
+
+// Requests posted by int and the device threads are taken here, on the processor thread, between two instructions
+// Returns false when the run has to stop
+bool Emulator::handleInterrupts() {
+  if(stopRequested || instructionCount >= pauseAt) return false;
+  if(instructionCount >= stopAt) {
+    *out << "Instruction limit reached" << endl;
+    return false;
+  }
+
+  if(instructionCount >= checkpointAt) {
+    checkpointAt = UINT64_MAX;
+    updateDeadline();
+    if(!saveCheckpoint(options.saveFile)) *out << "Unable to write the checkpoint " << options.saveFile << endl;
+  }
+  if(instructionCount >= timerDeadline) virtualTimer();
+
+  if(pendingInterrupts.load() & STATS_REQUEST) {
+    pendingInterrupts.fetch_and(~STATS_REQUEST);
+    if(!writeStats(true)) *out << "Unable to write the statistics " << options.stats << endl;
+  }
+
+  deliverInterrupt();
+
+  // after the interrupts, a step into a handler stops at its first instruction
+  if(debugger && ((pendingInterrupts.load() & DEBUG_REQUEST) || instructionCount >= debugAt)) debugger->stop();
+  return true;
+}
+
+// The interrupt controller: of the pending requests that status lets through, the one with the highest priority
+// is taken and the others stay pending until its handler unmasks them or returns
+void Emulator::deliverInterrupt() {
+  uint32_t requests = pendingInterrupts.load() & enabledInterrupts();
+  // an iret restores status before it pops pc, an interrupt in between would push the pc of the pop
+  if(!requests || instructionCount == statusWrittenAt) return;
+
+  const interruptSource *source = INTERRUPT_SOURCES;
+  while(!(requests & source->request)) source++;
+
+  uint32_t input = 0;
+  if(source->request == TERMINAL_INTERRUPT) {
+    uint32_t head = terminalHead.load(memory_order_relaxed);
+    memory.write8(TERM_IN_START, static_cast<uint8_t>(terminalBuffer[head % TERMINAL_BUFFER_SIZE]));
+    terminalHead.store(head + 1, memory_order_release);
+    input = memory.read8(TERM_IN_START);
+
+    // the request stays posted while there are characters in the buffer
+    if(head + 1 == terminalTail.load(memory_order_acquire)) {
+      pendingInterrupts.fetch_and(~TERMINAL_INTERRUPT);
+      if(head + 1 != terminalTail.load(memory_order_acquire)) pendingInterrupts.fetch_or(TERMINAL_INTERRUPT);
+    }
+  } else {
+    pendingInterrupts.fetch_and(~source->request);
+  }
+  if(tracer) tracer->interrupt(source->cause, input);
+  counters[source->counter]++;
+
+  // push status; push pc; cause<=source cause; status<=status | request; pc<=handler;
+  gprs[14] = gprs[14] - 4;
+  write4Bytes(gprs[14], csrs[0]);
+
+  gprs[14] = gprs[14] - 4;
+  write4Bytes(gprs[14], gprs[15]);
+
+  csrs[2] = source->cause;
+
+  csrs[0] |= source->request;
+  statusChanged();
+
+  gprs[15] = csrs[1];
+  if(profiler) profiler->call(gprs[15]);
+}
+
+// pending bits that handleInterrupts would take with the current status
+uint32_t Emulator::enabledInterrupts() {
+  if(csrs[0] & SOFTWARE_INTERRUPT) return 0;
+  return ~csrs[0] & (TIMER_INTERRUPT | TERMINAL_INTERRUPT | SOFTWARE_INTERRUPT | DMA_INTERRUPT);
+}
+
+// An idiom retires all of its instructions at once unless that would pass the next event, then only its first
+// instruction is executed and the others are fetched one by one, so interrupts and limits see the same counts
+template<uint8_t MOD>
+void Emulator::fused(uint32_t pc, uint8_t A, uint8_t B, uint8_t C, int32_t D) {
+  // instructions after the first, for a branch when it isn't taken
+  static const uint8_t following[DecodeCache::FUSED_OPS] = {1, 2, 1, 0, 0, 1, 1, 1};
+  bool whole = instructionCount + following[MOD] <= eventDeadline;
+  uint32_t retired = following[MOD];
+
+  if constexpr(MOD == (DecodeCache::LD_LITERAL & 0xF)) {
+    gprs[A] = D;
+    gprs[15] = whole ? pc + 12 : pc + 4;
+  } else if constexpr(MOD == (DecodeCache::LD_MEMORY_LITERAL & 0xF)) {
+    if(whole) {
+      // the load from the literal is the second instruction, a device it reads sees the count without fusion
+      instructionCount++;
+      gprs[A] = read4Bytes(D);
+      instructionCount--;
+      gprs[15] = pc + 16;
+    } else {
+      gprs[A] = D;
+      gprs[15] = pc + 4;
+    }
+  } else if constexpr(MOD == (DecodeCache::ST_MEMORY_LITERAL & 0xF)) {
+    write4Bytes(D, gprs[C]);
+    gprs[15] = whole ? pc + 12 : pc + 4;
+  } else if constexpr(MOD == (DecodeCache::JMP_LITERAL & 0xF)) {
+    gprs[15] = D;
+    if(gprs[15] < pc + 4) idleCheck();
+  } else if constexpr(MOD == (DecodeCache::CALL_LITERAL & 0xF)) {
     gprs[14] = gprs[14] - 4;
-    write4Bytes(gprs[14], csrs[0]);
+    write4Bytes(gprs[14], pc + 4);
+    gprs[15] = D;
+  } else {
+    bool taken = MOD == (DecodeCache::BEQ_LITERAL & 0xF) ? gprs[B] == gprs[C] :
+                 MOD == (DecodeCache::BNE_LITERAL & 0xF) ? gprs[B] != gprs[C] : (int) gprs[B] > (int) gprs[C];
+    if(taken) {
+      retired = 0;
+      gprs[15] = D;
+      if(gprs[15] < pc + 4) idleCheck();
+    } else {
+      gprs[15] = whole ? pc + 12 : pc + 4;
+    }
+  }
+
+  if(!whole && retired) return;
+  instructionCount += retired;
+  fusedCounts[MOD]++;
+  fusedInstructions += retired + 1;
+}
 
+// The entry of a pc with a breakpoint, the guest stops before the instruction and runs it from a new decode of its word
+// when it goes on from there, so the entry keeps the breakpoint; returns false on halt
+bool Emulator::breakpoint(DecodeCache::decodedInstruction decoded) {
+  if(!debugger->resumedFrom(decoded.pc, instructionCount - 1)) {
+    gprs[15] = decoded.pc;
+    instructionCount--;
+    debugger->stop();
+    if(stopRequested || gprs[15] != decoded.pc) return true;
+    gprs[15] = gprs[15] + 4;
+    instructionCount++;
+  }
+
+  uint32_t word = devices.mayHit(decoded.pc) ? deviceRead(decoded.pc) : memory.read32(decoded.pc);
+  DecodeCache::decodedInstruction original = DecodeCache::specialize(DecodeCache::decode(decoded.pc, word));
+  return execute(&original);
+}
+
+// The semantics of one op, every handler is compiled for its own OC and MOD so it doesn't test them;
+// writes to r0 and loads into pc are told apart by DecodeCache::specialize, not here
+template<uint8_t OP>
+bool Emulator::instruction(DecodeCache::decodedInstruction decoded) {
+  uint8_t A = decoded.A;
+  uint8_t B = decoded.B;
+  uint8_t C = decoded.C;
+  int32_t D = decoded.D;
+
+  if constexpr(OP == DecodeCache::HALT) {
+    halted = true;
+    return false;
+  } else if constexpr(OP == DecodeCache::INT) {
+    interrupt();
+  } else if constexpr(OP == 0x20 || OP == 0x21) {
+    // push pc; pc<=gpr[A]+gpr[B]+D, or mem32 at that address
     gprs[14] = gprs[14] - 4;
     write4Bytes(gprs[14], gprs[15]);
 
-    csrs[2] = 4;
-
-    csrs[0] |= 0x4;
-
-    gprs[15] = csrs[1];
-  }
-}
-
-void Emulator::call(uint8_t MOD, uint8_t A, uint8_t B, int32_t D) {
-  switch(MOD) {
-    case 0:
-      // push pc; pc<=gpr[A]+gpr[B]+D; 
-      gprs[14] = gprs[14] - 4;
-      write4Bytes(gprs[14], gprs[15]);
-
-      gprs[15] = gprs[A] + gprs[B] + D;
-      break;
-    case 1:
-      // push pc; pc<=mem32[gpr[A]+gpr[B]+D]; 
-      gprs[14] = gprs[14] - 4;
-      write4Bytes(gprs[14], gprs[15]);
-
-      gprs[15] = read4Bytes(gprs[A] + gprs[B] + D);
-      break;
-    default:
-      cout << "UNKNOWN INSTRUCTION" << endl;
-      break;
-  }
-}
-
-void Emulator::jump(uint8_t MOD, uint8_t A, uint8_t B, uint8_t C, int32_t D) {
-  switch(MOD) {
-    case 0:
-      gprs[15] = gprs[A] + D;
-      break;
-    case 1:
-      if(gprs[B] == gprs[C]) gprs[15] = gprs[A] + D;
-      break;
-    case 2:
-      if(gprs[B] != gprs[C]) gprs[15] = gprs[A] + D;
-      break;
-    case 3:
-      if((int) gprs[B] > (int) gprs[C]) gprs[15] = gprs[A] + D;
-      break;
-    case 8:
-      gprs[15] = read4Bytes(gprs[A] + D);
-      break;
-    case 9:
-      if(gprs[B] == gprs[C]) gprs[15] = read4Bytes(gprs[A] + D);
-      break;
-    case 10:
-      if(gprs[B] != gprs[C]) gprs[15] = read4Bytes(gprs[A] + D);
-      break;
-    case 11:
-      if((int) gprs[B] > (int) gprs[C]) gprs[15] = read4Bytes(gprs[A] + D);
-      break;
-    default:
-      cout << "UNKNOWN INSTRUCTION" << endl;
-      break;
-  }
-}
-
-void Emulator::xchg(uint8_t B, uint8_t C) {
-  if(B == 0 || C == 0) return;
-  uint32_t temp = gprs[B];
-  gprs[B] = gprs[C];
-  gprs[C] = temp;
-}
-
-void Emulator::arit(uint8_t MOD, uint8_t A, uint8_t B, uint8_t C) {
-  if(A == 0) return;
-  switch(MOD) {
-    case 0:
-      gprs[A] = gprs[B] + gprs[C];
-      break;
-    case 1:
-      gprs[A] = gprs[B] - gprs[C];
-      break;
-    case 2:
-      gprs[A] = gprs[B] * gprs[C];
-      break;
-    case 3:
-      gprs[A] = gprs[B] / gprs[C];
-      break;
-    default:
-      cout << "UNKNOWN INSTRUCTION" << endl;
-      break;
-  }
-}
-
-void Emulator::log(uint8_t MOD, uint8_t A, uint8_t B, uint8_t C) {
-  if(A == 0) return;
-  switch(MOD) {
-    case 0:
-      gprs[A] = ~gprs[B];
-      break;
-    case 1:
-      gprs[A] = gprs[B] & gprs[C];
-      break;
-    case 2:
-      gprs[A] = gprs[B] | gprs[C];
-      break;
-    case 3:
-      gprs[A] = gprs[B] ^ gprs[C];
-      break;
-    default:
-      cout << "UNKNOWN INSTRUCTION" << endl;
-      break;
-  }
-}
-
-void Emulator::shift(uint8_t MOD, uint8_t A, uint8_t B, uint8_t C) {
-  if(A == 0) return;
-  switch(MOD) {
-  case 0:
+    gprs[15] = OP == 0x21 ? read4Bytes(gprs[A] + gprs[B] + D) : gprs[A] + gprs[B] + D;
+    if(profiler) profiler->call(gprs[15]);
+  } else if constexpr(OP >> 4 == 3 && (OP & 0x7) <= 3) {
+    // jmp, beq, bne and bgt to gpr[A]+D, or to mem32 at that address from MOD 8
+    uint32_t from = gprs[15];
+    bool taken = (OP & 0x3) == 0 || ((OP & 0x3) == 1 ? gprs[B] == gprs[C] : (OP & 0x3) == 2 ? gprs[B] != gprs[C] : (int) gprs[B] > (int) gprs[C]);
+    if(taken) gprs[15] = OP & 0x8 ? read4Bytes(gprs[A] + D) : gprs[A] + D;
+    if(gprs[15] < from) idleCheck();
+  } else if constexpr(OP == 0x40) {
+    swap(gprs[B], gprs[C]);
+  } else if constexpr(OP == 0x50) {
+    gprs[A] = gprs[B] + gprs[C];
+  } else if constexpr(OP == 0x51) {
+    gprs[A] = gprs[B] - gprs[C];
+  } else if constexpr(OP == 0x52) {
+    gprs[A] = gprs[B] * gprs[C];
+  } else if constexpr(OP == 0x53) {
+    gprs[A] = gprs[B] / gprs[C];
+  } else if constexpr(OP == 0x60) {
+    gprs[A] = ~gprs[B];
+  } else if constexpr(OP == 0x61) {
+    gprs[A] = gprs[B] & gprs[C];
+  } else if constexpr(OP == 0x62) {
+    gprs[A] = gprs[B] | gprs[C];
+  } else if constexpr(OP == 0x63) {
+    gprs[A] = gprs[B] ^ gprs[C];
+  } else if constexpr(OP == 0x70) {
     gprs[A] = gprs[B] << gprs[C];
-    break;
-  case 1:
+  } else if constexpr(OP == 0x71) {
     gprs[A] = gprs[B] >> gprs[C];
-    break;
-  default:
-    cout << "UNKNOWN INSTRUCTION" << endl;
-    break;
-  }
-}
-
-void Emulator::st(uint8_t MOD, uint8_t A, uint8_t B, uint8_t C, int32_t D) {
-  switch(MOD) {
-    case 0:
-      write4Bytes(gprs[A] + gprs[B] + D, gprs[C]);
-      break;
-    case 1:
-      if(A == 0) return;
-      gprs[A] = gprs[A] + (int32_t) D;
-      write4Bytes(gprs[A], gprs[C]);
-      break;
-    case 2:
-      write4Bytes(read4Bytes(gprs[A] + gprs[B] + D), gprs[C]);
-      break;
-    default:
-      cout << "UNKNOWN INSTRUCTION" << endl;
-      break;
-  }
-}
-
-void Emulator::ld(uint8_t MOD, uint8_t A, uint8_t B, uint8_t C, int32_t D) {
-  switch(MOD) {
-    case 0:
-      if(A == 0) return;
-      gprs[A] = csrs[B];
-      break;
-    case 1:
-      if(A == 0) return;
-      gprs[A] = gprs[B] + D;
-      break;
-    case 2:
-      if(A == 0) return;
-      gprs[A] = read4Bytes(gprs[B] + gprs[C] + D) ;
-      break;
-    case 3:
-      if(A == 0 || B == 0) return;
-      gprs[A] = read4Bytes(gprs[B]);
-      gprs[B] = gprs[B] + D;
-      break;
-    case 4:
-      csrs[A] = gprs[B];
-      break;
-    case 5:
-      csrs[A] = csrs[B] + D;
-      break;
-    case 6:
-      csrs[A] = read4Bytes(gprs[B] + gprs[C] + D);
-      break;
-    case 7:
-      if(B == 0) return;
-      csrs[A] = read4Bytes(gprs[B]);
-      gprs[B] = gprs[B] + D;
-      break;
-    default:
-      cout << "UNKNOWN INSTRUCTION" << endl;
-      break;
+  } else if constexpr(OP == 0x80) {
+    write4Bytes(gprs[A] + gprs[B] + D, gprs[C]);
+  } else if constexpr(OP == 0x81) {
+    gprs[A] = gprs[A] + D;
+    write4Bytes(gprs[A], gprs[C]);
+  } else if constexpr(OP == 0x82) {
+    write4Bytes(read4Bytes(gprs[A] + gprs[B] + D), gprs[C]);
+  } else if constexpr(OP == 0x90) {
+    gprs[A] = csrs[B];
+  } else if constexpr(OP == 0x91) {
+    gprs[A] = gprs[B] + D;
+  } else if constexpr(OP == 0x92) {
+    gprs[A] = read4Bytes(gprs[B] + gprs[C] + D);
+  } else if constexpr(OP == 0x93) {
+    gprs[A] = read4Bytes(gprs[B]);
+    gprs[B] = gprs[B] + D;
+  } else if constexpr(OP == DecodeCache::LD_PC) {
+    gprs[15] = read4Bytes(gprs[B] + gprs[C] + D);
+    if(profiler) profiler->ret();
+  } else if constexpr(OP == DecodeCache::LD_PC_POST) {
+    // pop pc, the return of a call
+    gprs[15] = read4Bytes(gprs[B]);
+    gprs[B] = gprs[B] + D;
+    if(profiler) profiler->ret();
+  } else if constexpr(OP == 0x94) {
+    writeCsr(A, gprs[B]);
+  } else if constexpr(OP == 0x95) {
+    writeCsr(A, csrs[B] + D);
+  } else if constexpr(OP == 0x96) {
+    writeCsr(A, read4Bytes(gprs[B] + gprs[C] + D));
+  } else if constexpr(OP == 0x97) {
+    uint32_t value = read4Bytes(gprs[B]);
+    writeCsr(A, value);
+    gprs[B] = gprs[B] + D;
+  } else if constexpr(OP == DecodeCache::NOP) {
+    // a write to r0 or an exchange with it
+  } else if constexpr(OP == DecodeCache::BREAKPOINT) {
+    return breakpoint(decoded);
+  } else if constexpr(OP >= DecodeCache::LD_LITERAL && OP < DecodeCache::LD_LITERAL + DecodeCache::FUSED_OPS) {
+    fused<OP & 0xF>(decoded.pc, A, B, C, D);
+  } else {
+    *out << "UNKNOWN INSTRUCTION" << endl;
   }
+  return true;
 }
 
+template<size_t... OPS>
+constexpr array<Emulator::instructionHandler, 256> Emulator::handlerTable(index_sequence<OPS...>) {
+  return {{&Emulator::instruction<OPS>...}};
+}
+
+const array<Emulator::instructionHandler, 256> Emulator::instructionHandlers = Emulator::handlerTable(make_index_sequence<256>());
+
 
 uint32_t Emulator::read4Bytes(uint32_t address) {
-  uint32_t value = 0;
-  for(int i = 0; i < 4; i++) value |= memory[address + i] << 8 * i;
-  return value;
+  if(countAccesses) countAccess(address, false);
+  if(devices.mayHit(address)) {
+    if(debugger) debugger->access(address, false);
+    return deviceRead(address);
+  }
+  return memory.read32(address);
 }
 
 void Emulator::write4Bytes(uint32_t address, uint32_t value) {
-  for(int i = 0; i < 4; i++) memory[address + i] = static_cast<uint8_t>((value >> 8 * i) & 0xFF);
+  if(devices.mayHit(address)) {
+    if(debugger) debugger->access(address, true);
+    deviceWrite(address, value);
+  } else {
+    memory.write32(address, value);
+  }
+  storeCount++;
+  if(countAccesses) countAccess(address, true);
+  if(tracer) tracer->store(address, value);
+  decodeCache.invalidate(address);
+  jit.invalidate(address);
+  if(multiCore) invalidateOtherCores(address);
 }
 
+// device registers aren't cached
+void Emulator::countAccess(uint32_t address, bool write) {
+  if(stats) counters[write ? MEMORY_WRITES : MEMORY_READS]++;
+  if(caches && !devices.mayHit(address)) caches->data(address, write);
+}
 
-void Emulator::emulatingTerminal() {
-  if(memory.find(TERM_OUT_START) != memory.end()) {
-    uint8_t value = memory[TERM_OUT_START];
-    cout << static_cast<char>(value);
-    cout.flush();
-    memory.erase(TERM_OUT_START);
+// Stores of the host go around the devices
+void Emulator::hostWrite(uint32_t address, const uint8_t *bytes, size_t size) {
+  memory.writeBlock(address, bytes, size);
+  codeWritten(address, size);
+}
+
+// the decoded and translated code of a range written by the host is dropped, on every core
+void Emulator::codeWritten(uint32_t address, size_t size) {
+  decodeCache.invalidateRange(address, size);
+  jit.invalidate(address, size);
+  if(!multiCore || !size) return;
+  uint64_t last = (static_cast<uint64_t>(address) + size - 1) >> Memory::PAGE_BITS;
+  for(uint64_t page = address >> Memory::PAGE_BITS; page <= last; page++) invalidateOtherCores(max<uint64_t>(address, page << Memory::PAGE_BITS));
+}
+
+void Emulator::ownCode(const DecodeCache::decodedInstruction *decoded) {
+  for(uint32_t page : {decoded->pc >> Memory::PAGE_BITS, DecodeCache::lastPage(*decoded)}) {
+    atomic<uint32_t> &owners = machine->codeOwners[page];
+    if(!(owners.load(memory_order_relaxed) & 1u << coreId)) owners.fetch_or(1u << coreId);
+  }
+}
+
+void Emulator::dropDecodedInstructions() {
+  dropDecoded = false;
+  for(uint32_t page : decodeCache.pages()) machine->codeOwners[page].fetch_and(~(1u << coreId));
+  decodeCache.clear();
+}
+
+void Emulator::invalidateOtherCores(uint32_t address) {
+  for(uint32_t page : {address >> Memory::PAGE_BITS, (address + 3) >> Memory::PAGE_BITS}) {
+    uint32_t others = machine->codeOwners[page].load(memory_order_relaxed) & ~(1u << coreId);
+    for(uint32_t id = 0; others; id++, others >>= 1) {
+      if(others & 1) machine->core(id)->dropDecoded.store(true, memory_order_release);
+    }
+  }
+}
+
+// Terminal and timer of core 0, their registers are kept in memory like before there were device callbacks
+void Emulator::addDevices() {
+  devices.add("terminal", TERM_OUT_START, TERM_IN_END, nullptr, [this](uint32_t address, uint32_t value) { terminalWrite(address, value); });
+  devices.add("timer", TIM_CFG_START, TIM_CFG_END, nullptr, [this](uint32_t address, uint32_t value) { timerWrite(address, value); });
+  devices.add("dma", DMA_SRC, DMA_END, nullptr, [this](uint32_t address, uint32_t value) { dmaWrite(address, value); });
+  devices.add("counters", COUNTERS_START, COUNTERS_END, [this](uint32_t address) { return accessingCore->counterRead(address); }, nullptr);
+}
+
+// the devices are those of core 0, with several cores their callbacks run under one lock
+uint32_t Emulator::deviceRead(uint32_t address) {
+  const DeviceRegistry::deviceRegion *region = devices.find(address);
+  if(region) counters[MMIO_READS]++;
+  if(!region || !region->read) return memory.read32(address);
+  if(!multiCore) return region->read(address);
+
+  lock_guard<mutex> lock(machine->deviceMutex);
+  machine->accessingCore = this;
+  return region->read(address);
+}
+
+void Emulator::deviceWrite(uint32_t address, uint32_t value) {
+  const DeviceRegistry::deviceRegion *region = devices.find(address);
+  if(region) counters[MMIO_WRITES]++;
+  if(!region || !region->write) {
+    memory.write32(address, value);
+  } else if(!multiCore) {
+    region->write(address, value);
+  } else {
+    lock_guard<mutex> lock(machine->deviceMutex);
+    machine->accessingCore = this;
+    region->write(address, value);
   }
+}
+
+void Emulator::terminalWrite(uint32_t address, uint32_t value) {
+  memory.write32(address, value);
+  if(address <= TERM_OUT_END && address + 3 >= TERM_OUT_START) {
+    *out << static_cast<char>(memory.read8(TERM_OUT_START));
+    out->flush();
+    memory.write32(TERM_OUT_START, 0);
+  }
+}
+
+void Emulator::timerWrite(uint32_t address, uint32_t value) {
+  memory.write32(address, value);
+  {
+    lock_guard<mutex> lock(timerMutex);
+    timerConfig = memory.read8(TIM_CFG_START);
+    timerRearmed = true;
+  }
+  timerWakeup.notify_one();
+  if(!options.virtualTime && !timerThread.joinable()) startTimer();
+  if(options.virtualTime) {
+    int period_ms = getTimerPeriod(timerConfig);
+    timerDeadline = period_ms > 0 ? instructionCount + period_ms * options.instructionsPerMs : UINT64_MAX;
+    updateDeadline();
+  }
+}
 
-  if(!(csrs[0] & 0x2) && !(csrs[0] & 0x4)) {
-    char input;
-    if(read(STDIN_FILENO, &input, 1) > 0) {
-      memory[TERM_IN_START] = static_cast<uint8_t>(input);
-      
-      // push status; push pc; cause<=3; status<=status | 0x2; pc<=handler; 
-      gprs[14] = gprs[14] - 4;
-      write4Bytes(gprs[14], csrs[0]);
+// The transfer runs for the core that started it, which also takes the interrupt
+void Emulator::dmaWrite(uint32_t address, uint32_t value) {
+  memory.write32(address, value);
+  uint32_t control = memory.read32(DMA_CTRL);
+  if(address + 3 < DMA_CTRL || !(control & DMA_RUN)) return;
 
-      gprs[14] = gprs[14] - 4;
-      write4Bytes(gprs[14], gprs[15]);
+  Emulator *core = accessingCore;
+  bool done = core->dmaTransfer(memory.read32(DMA_DST), memory.read32(DMA_SRC), memory.read32(DMA_LEN), control & DMA_FILL);
+  control = (control & ~(DMA_RUN | DMA_DONE | DMA_ERROR)) | (done ? DMA_DONE : DMA_ERROR);
+  memory.write32(DMA_CTRL, control);
+  if(control & DMA_INTERRUPT_ENABLE) core->pendingInterrupts.fetch_or(DMA_INTERRUPT);
+}
 
-      csrs[2] = 3;
+// Copies or fills guest memory a page at a time on the host, around the devices; to the guest it is one store,
+// false when a range wraps around the address space
+bool Emulator::dmaTransfer(uint32_t destination, uint32_t source, uint32_t length, bool fill) {
+  if(!length) return true;
+  if(destination > UINT32_MAX - (length - 1) || (!fill && source > UINT32_MAX - (length - 1))) return false;
 
-      csrs[0] |= 0x2;
+  if(fill) memory.fillBlock(destination, static_cast<uint8_t>(source), length);
+  else memory.copyBlock(destination, source, length);
+  storeCount++;
+  if(tracer) {
+    for(uint64_t offset = 0; offset < length; offset += 4) tracer->store(destination + offset, memory.read32(destination + offset));
+  }
+  codeWritten(destination, length);
+  return true;
+}
+
+
+// Runs on its own thread and sleeps in poll until there is input, the processor takes one character per interrupt
+void Emulator::emulatingTerminal() {
+  struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {terminalWakeFds[0], POLLIN, 0}};
+  bool input = true;
 
-      gprs[15] = csrs[1];
+  while(!end) {
+    uint32_t tail = terminalTail.load(memory_order_relaxed);
+    uint32_t space = TERMINAL_BUFFER_SIZE - (tail - terminalHead.load(memory_order_acquire));
+
+    // poll ignores negative descriptors, a full buffer is checked again after a while
+    fds[0].fd = input && space ? STDIN_FILENO : -1;
+    if(poll(fds, 2, space ? -1 : 10) <= 0) continue;
+    if(!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+    char chars[TERMINAL_BUFFER_SIZE];
+    ssize_t count = read(STDIN_FILENO, chars, space);
+    if(count == 0 || (count < 0 && errno != EAGAIN && errno != EINTR)) {
+      input = false;
+      terminalOpen = false;
+      notifyProcessor();
+      continue;
     }
+
+    for(ssize_t i = 0; i < count; i++) terminalBuffer[(tail + i) % TERMINAL_BUFFER_SIZE] = chars[i];
+    if(count > 0) {
+      terminalTail.store(tail + count, memory_order_release);
+      postInterrupt(TERMINAL_INTERRUPT);
+    }
+  }
+}
+
+// Characters of the host, queued as if the terminal thread had read them, returns how many fit
+size_t Emulator::terminalInput(const char *chars, size_t count) {
+  uint32_t tail = terminalTail.load(memory_order_relaxed);
+  count = min<size_t>(count, TERMINAL_BUFFER_SIZE - (tail - terminalHead.load(memory_order_acquire)));
+  for(size_t i = 0; i < count; i++) terminalBuffer[(tail + i) % TERMINAL_BUFFER_SIZE] = chars[i];
+  if(count > 0) {
+    terminalTail.store(tail + count, memory_order_release);
+    postInterrupt(TERMINAL_INTERRUPT);
   }
+  return count;
 }
 
 void Emulator::setRawMode(bool enable) {
-  static struct termios oldt, newt;
   if(enable) {
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-  } else {
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    rawMode = tcgetattr(STDIN_FILENO, &savedTermios) == 0;
+    if(!rawMode) return;
+    struct termios raw = savedTermios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+  } else if(rawMode) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &savedTermios);
+    rawMode = false;
   }
 }
 
@@ -402,35 +1206,93 @@ void Emulator::setNonBlocking(bool enable) {
 }
 
 
+void Emulator::startTimer() {
+  timerThread = thread(&Emulator::emulatingTimer, this);
+}
+
+// Runs on its own thread and only posts the request, the processor takes it in handleInterrupts.
+// It sleeps until an absolute deadline, so the time spent posting doesn't add up over the periods,
+// and without a valid period until the next store to TIM_CFG
 void Emulator::emulatingTimer() {
+  unique_lock<mutex> lock(timerMutex);
+  auto woken = [this] { return end || timerRearmed; };
+  chrono::steady_clock::time_point deadline;
+
   while(!end) {
-    sem_wait(&mutex);
-    if(memory.find(TIM_CFG_START) != memory.end()) {
-      if(!(csrs[0] & 0x1) && !(csrs[0] & 0x4)) {
-        int tim_cfg_value = memory[TIM_CFG_START];
-        int period_ms = getTimerPeriod(tim_cfg_value);
+    int period_ms = getTimerPeriod(timerConfig);
+    chrono::milliseconds period(max(period_ms, 0));
+    if(timerRearmed) {
+      timerRearmed = false;
+      deadline = chrono::steady_clock::now() + period;
+    }
+    if(period_ms <= 0) {
+      timerWakeup.wait(lock, woken);
+      continue;
+    }
+    if(timerWakeup.wait_until(lock, deadline, woken)) continue;
 
-        if(period_ms > 0) {
-          sem_post(&mutex);
-          this_thread::sleep_for(chrono::milliseconds(period_ms));
-          sem_wait(&mutex);
+    // a host that fell behind by whole periods posts once, the request is still pending anyway
+    auto now = chrono::steady_clock::now();
+    while(deadline <= now) deadline += period;
+    lock.unlock();
+    postInterrupt(TIMER_INTERRUPT);
+    lock.lock();
+  }
+}
 
-          // push status; push pc; cause<=2; status<=status | 0x1; pc<=handler; 
-          gprs[14] = gprs[14] - 4;
-          write4Bytes(gprs[14], csrs[0]);
+// Virtual time, one millisecond of the period is instructionsPerMs retired instructions
+void Emulator::virtualTimer() {
+  pendingInterrupts.fetch_or(TIMER_INTERRUPT);
+  timerDeadline = instructionCount + getTimerPeriod(timerConfig) * options.instructionsPerMs;
+  updateDeadline();
+}
 
-          gprs[14] = gprs[14] - 4;
-          write4Bytes(gprs[14], gprs[15]);
+// Called after a backward jump, a loop that makes no stores and comes back with the same registers
+// can only be left through an interrupt, virtual time skips to the timer deadline and real time sleeps until a request
+void Emulator::idleCheck() {
+  // another core may be the one that changes what the loop reads, a step of the debugger ends after one instruction
+  if(multiCore || debugAt != UINT64_MAX) return;
 
-          csrs[2] = 2;
+  if(gprs[15] == idleLoop.target && storeCount == idleLoop.stores && equal(gprs, gprs + 16, idleLoop.gprs)) {
+    idleLoops++;
+    if(options.virtualTime && (enabledInterrupts() & TIMER_INTERRUPT) && timerDeadline != UINT64_MAX) {
+      if(timerDeadline > instructionCount) skippedInstructions += timerDeadline - instructionCount;
+      timerDeadline = instructionCount;
+      updateDeadline();
+    } else {
+      idleWait();
+    }
+    return;
+  }
 
-          csrs[0] |= 0x1;
+  idleLoop.target = gprs[15];
+  idleLoop.stores = storeCount;
+  copy(gprs, gprs + 16, idleLoop.gprs);
+}
 
-          gprs[15] = csrs[1];
-        }
-      }
-    }
-    sem_post(&mutex);
+// a request that is already pending, the real time timer, terminal input or gdb
+bool Emulator::canWake(uint32_t enabled) {
+  if(pendingInterrupts.load() & enabled) return true;
+  if(debugger && debugger->connected()) return true;
+  if((enabled & TIMER_INTERRUPT) && !options.virtualTime && getTimerPeriod(timerConfig) > 0) return true;
+  return (enabled & TERMINAL_INTERRUPT) && terminalOpen;
+}
+
+// a guest that no device can wake would spin forever, the run is stopped instead
+void Emulator::idleWait() {
+  auto start = chrono::steady_clock::now();
+  {
+    unique_lock<mutex> lock(idleMutex);
+    idleWakeup.wait(lock, [this] { return (pendingInterrupts.load() & acceptedRequests) || !canWake(enabledInterrupts()) || end; });
+  }
+  chrono::duration<double> slept = chrono::steady_clock::now() - start;
+  idleSeconds += slept.count();
+
+  if(!canWake(enabledInterrupts())) {
+    if(!options.embedded) *out << "Emulated processor is idle and no device can interrupt it" << endl;
+    idleStopped = true;
+    stopRequested = true;
+    updateDeadline();
   }
 }
 
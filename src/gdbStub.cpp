@@ -0,0 +1,427 @@
+#include "./../inc/gdbStub.hpp"
+#include "./../inc/emulator.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// the registers of qXfer:features:read, in the order of the g packet
+static const char *TARGET_XML =
+  "<?xml version=\"1.0\"?>"
+  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+  "<target version=\"1.0\"><feature name=\"org.emulator.core\">"
+  "<reg name=\"r0\" bitsize=\"32\" type=\"uint32\" regnum=\"0\"/>"
+  "<reg name=\"r1\" bitsize=\"32\" type=\"uint32\"/><reg name=\"r2\" bitsize=\"32\" type=\"uint32\"/>"
+  "<reg name=\"r3\" bitsize=\"32\" type=\"uint32\"/><reg name=\"r4\" bitsize=\"32\" type=\"uint32\"/>"
+  "<reg name=\"r5\" bitsize=\"32\" type=\"uint32\"/><reg name=\"r6\" bitsize=\"32\" type=\"uint32\"/>"
+  "<reg name=\"r7\" bitsize=\"32\" type=\"uint32\"/><reg name=\"r8\" bitsize=\"32\" type=\"uint32\"/>"
+  "<reg name=\"r9\" bitsize=\"32\" type=\"uint32\"/><reg name=\"r10\" bitsize=\"32\" type=\"uint32\"/>"
+  "<reg name=\"r11\" bitsize=\"32\" type=\"uint32\"/><reg name=\"r12\" bitsize=\"32\" type=\"uint32\"/>"
+  "<reg name=\"r13\" bitsize=\"32\" type=\"uint32\"/><reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+  "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/><reg name=\"status\" bitsize=\"32\" type=\"uint32\"/>"
+  "<reg name=\"handler\" bitsize=\"32\" type=\"code_ptr\"/><reg name=\"cause\" bitsize=\"32\" type=\"uint32\"/>"
+  "</feature></target>";
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static string hexByte(uint8_t value) {
+  return string{HEX_DIGITS[value >> 4], HEX_DIGITS[value & 0xF]};
+}
+
+// registers are sent as their bytes in memory order
+static string hexWord(uint32_t value) {
+  string result;
+  for(int i = 0; i < 4; i++) result += hexByte(value >> 8 * i);
+  return result;
+}
+
+static bool parseWord(const string &text, size_t position, uint32_t &value) {
+  if(text.size() < position + 8) return false;
+  value = 0;
+  for(int i = 0; i < 4; i++) {
+    char digits[3] = {text[position + 2 * i], text[position + 2 * i + 1], 0};
+    char *end;
+    uint32_t byte = strtoul(digits, &end, 16);
+    if(*end) return false;
+    value |= byte << 8 * i;
+  }
+  return true;
+}
+
+GdbStub::GdbStub(Emulator *emulator, const string &address) : emulator(emulator), address(address) {}
+
+GdbStub::~GdbStub() {
+  if(watcherThread.joinable()) {
+    {
+      lock_guard<mutex> lock(watchMutex);
+      finished = true;
+      char wake = 0;
+      if(polling) write(wakeFds[1], &wake, 1);
+      watchWakeup.notify_one();
+    }
+    watcherThread.join();
+  }
+  if(fd >= 0) close(fd);
+  if(listenFd >= 0) close(listenFd);
+  if(wakeFds[0] >= 0) {
+    close(wakeFds[0]);
+    close(wakeFds[1]);
+  }
+}
+
+// a port on localhost when the address is a number, the path of a Unix socket otherwise
+bool GdbStub::listen() {
+  if(!address.empty() && address.find_first_not_of("0123456789") == string::npos) {
+    unsigned long port = strtoul(address.c_str(), nullptr, 10);
+    if(port == 0 || port > 65535) return false;
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd < 0) return false;
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(listenFd, reinterpret_cast<struct sockaddr *>(&local), sizeof(local)) < 0) return false;
+  } else {
+    struct sockaddr_un local = {};
+    if(address.empty() || address.size() >= sizeof(local.sun_path)) return false;
+    // a socket left by an earlier run is replaced, any other file is not
+    struct stat info;
+    if(stat(address.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) unlink(address.c_str());
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenFd < 0) return false;
+
+    local.sun_family = AF_UNIX;
+    address.copy(local.sun_path, address.size());
+    if(bind(listenFd, reinterpret_cast<struct sockaddr *>(&local), sizeof(local)) < 0) return false;
+  }
+  return ::listen(listenFd, 1) == 0;
+}
+
+// Waits for gdb, the stub serves only this connection
+bool GdbStub::accept() {
+  do {
+    fd = ::accept(listenFd, nullptr, nullptr);
+  } while(fd < 0 && errno == EINTR);
+  close(listenFd);
+  listenFd = -1;
+  if(address.find_first_not_of("0123456789") != string::npos) unlink(address.c_str());
+  if(fd < 0) return false;
+
+  int noDelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  if(pipe(wakeFds) != 0) {
+    wakeFds[0] = wakeFds[1] = -1;
+    close(fd);
+    fd = -1;
+    return false;
+  }
+  watcherThread = thread(&GdbStub::watching, this);
+  return true;
+}
+
+// The next packet without its framing, bytes outside of packets are acks or an interrupt and are dropped
+bool GdbStub::receive(string &packet) {
+  while(true) {
+    size_t start = input.find('$');
+    size_t hash = start == string::npos ? string::npos : input.find('#', start);
+    if(hash != string::npos && input.size() >= hash + 3) {
+      packet = input.substr(start + 1, hash - start - 1);
+      uint8_t sum = 0;
+      for(char c : packet) sum += c;
+      bool valid = strtoul(input.substr(hash + 1, 2).c_str(), nullptr, 16) == sum;
+      input.erase(0, hash + 3);
+      if(!noAck) ::send(fd, valid ? "+" : "-", 1, MSG_NOSIGNAL);
+      if(valid) return true;
+      continue;
+    }
+    if(start == string::npos) input.clear();
+
+    char buffer[PACKET_SIZE];
+    ssize_t count = read(fd, buffer, sizeof(buffer));
+    if(count < 0 && errno == EINTR) continue;
+    if(count <= 0) return false;
+    input.append(buffer, count);
+  }
+}
+
+// replies are not sent again on a nack, gdb and the stub are on the same host
+void GdbStub::send(const string &packet) {
+  uint8_t sum = 0;
+  for(char c : packet) sum += c;
+  string framed = "$" + packet + "#" + hexByte(sum);
+
+  size_t sent = 0;
+  while(sent < framed.size()) {
+    ssize_t count = ::send(fd, framed.data() + sent, framed.size() - sent, MSG_NOSIGNAL);
+    if(count < 0 && errno == EINTR) continue;
+    if(count <= 0) return;
+    sent += count;
+  }
+}
+
+string GdbStub::stopReply() {
+  if(watchHit) {
+    static const char *names[] = {"", "", "watch", "rwatch", "awatch"};
+    char address[9];
+    snprintf(address, sizeof(address), "%x", hitAddress);
+    return "T05" + string(names[hitKind]) + ":" + address + ";";
+  }
+  return interrupted ? "T02" : "T05";
+}
+
+uint32_t GdbStub::registerValue(uint32_t number) {
+  return number < 16 ? emulator->gprs[number] : emulator->csrs[number - 16];
+}
+
+string GdbStub::readRegisters() {
+  string reply;
+  for(uint32_t i = 0; i < REGISTERS; i++) reply += hexWord(registerValue(i));
+  return reply;
+}
+
+// r0 stays zero, the decoded instructions count on it
+bool GdbStub::writeRegister(uint32_t number, uint32_t value) {
+  if(number >= REGISTERS) return false;
+  if(number >= 16) {
+    emulator->csrs[number - 16] = value;
+    emulator->statusChanged();
+  }
+  else if(number) emulator->gprs[number] = value;
+  return true;
+}
+
+// Z and z packets, breakpoints go into the decode cache and watchpoints are checked on the accesses that reach
+// the devices path; false for a type that isn't supported
+bool GdbStub::setPoint(const string &packet, bool set) {
+  unsigned type;
+  uint32_t address;
+  uint32_t length;
+  if(sscanf(packet.c_str() + 1, "%u,%x,%x", &type, &address, &length) != 3 || type > ACCESS_WATCH) return false;
+
+  if(type < WRITE_WATCH) {
+    emulator->decodeCache.setBreakpoint(address, set);
+    return true;
+  }
+
+  uint32_t end = length ? address + length - 1 : address;
+  if(end < address) end = UINT32_MAX;
+  auto found = find_if(watchpoints.begin(), watchpoints.end(), [&](const watchpoint &point) {
+    return point.start == address && point.end == end && point.kind == type;
+  });
+  if(set && found == watchpoints.end()) watchpoints.push_back({address, end, static_cast<uint8_t>(type)});
+  if(!set && found != watchpoints.end()) watchpoints.erase(found);
+  updateWatches();
+  return true;
+}
+
+void GdbStub::updateWatches() {
+  uint32_t first = UINT32_MAX;
+  for(auto &point : watchpoints) first = min(first, point.start < 3 ? 0 : point.start - 3);
+  emulator->devices.watchFrom(first);
+}
+
+// Called on the processor thread for a guest load or store that took the devices path
+void GdbStub::access(uint32_t address, bool write) {
+  if(watchHit) return;
+  for(auto &point : watchpoints) {
+    bool touched = address <= point.end && (address > UINT32_MAX - 3 || address + 3 >= point.start);
+    bool kind = point.kind == ACCESS_WATCH || point.kind == (write ? WRITE_WATCH : READ_WATCH);
+    if(!touched || !kind) continue;
+
+    watchHit = true;
+    hitKind = point.kind;
+    hitAddress = max(address, point.start);
+    emulator->pendingInterrupts.fetch_or(Emulator::DEBUG_REQUEST);
+    return;
+  }
+}
+
+string GdbStub::command(const string &packet, bool &resumed) {
+  if(packet.empty()) return "";
+  char kind = packet[0];
+
+  if(packet == "?") return stopReply();
+  if(packet == "g") return readRegisters();
+  if(kind == 'G') {
+    uint32_t values[REGISTERS];
+    for(uint32_t i = 0; i < REGISTERS; i++) {
+      if(!parseWord(packet, 1 + 8 * i, values[i])) return "E01";
+    }
+    for(uint32_t i = 0; i < REGISTERS; i++) writeRegister(i, values[i]);
+    return "OK";
+  }
+  if(kind == 'p') {
+    uint32_t number = strtoul(packet.c_str() + 1, nullptr, 16);
+    return number < REGISTERS ? hexWord(registerValue(number)) : "E01";
+  }
+  if(kind == 'P') {
+    size_t equals = packet.find('=');
+    uint32_t value;
+    if(equals == string::npos || !parseWord(packet, equals + 1, value)) return "E01";
+    return writeRegister(strtoul(packet.c_str() + 1, nullptr, 16), value) ? "OK" : "E01";
+  }
+
+  // memory is read and written around the devices, like the host does
+  if(kind == 'm') {
+    uint32_t address;
+    uint32_t length;
+    if(sscanf(packet.c_str() + 1, "%x,%x", &address, &length) != 2) return "E01";
+    string reply;
+    for(uint32_t i = 0; i < min(length, PACKET_SIZE / 2); i++) reply += hexByte(emulator->memory.read8(address + i));
+    return reply;
+  }
+  if(kind == 'M') {
+    uint32_t address;
+    uint32_t length;
+    int data = 0;
+    if(sscanf(packet.c_str() + 1, "%x,%x:%n", &address, &length, &data) != 2 || !data || packet.size() < 1 + data + 2 * static_cast<size_t>(length)) return "E01";
+    vector<uint8_t> bytes(length);
+    for(uint32_t i = 0; i < length; i++) bytes[i] = strtoul(packet.substr(1 + data + 2 * i, 2).c_str(), nullptr, 16);
+    emulator->hostWrite(address, bytes.data(), bytes.size());
+    return "OK";
+  }
+
+  if(kind == 'c' || kind == 's') {
+    if(packet.size() > 1) emulator->gprs[15] = strtoul(packet.c_str() + 1, nullptr, 16);
+    resume(kind == 's');
+    resumed = true;
+    return "";
+  }
+  if(kind == 'Z' || kind == 'z') return setPoint(packet, kind == 'Z') ? "OK" : "";
+
+  if(packet == "k" || packet == "vKill" || packet.compare(0, 6, "vKill;") == 0) {
+    if(packet != "k") send("OK");
+    emulator->stopRequested = true;
+    emulator->updateDeadline();
+    resumed = true;
+    return "";
+  }
+  if(kind == 'D') {
+    send("OK");
+    detach();
+    resumed = true;
+    return "";
+  }
+
+  if(packet.compare(0, 10, "qSupported") == 0) return "PacketSize=" + to_string(PACKET_SIZE) + ";qXfer:features:read+;QStartNoAckMode+";
+  if(packet == "QStartNoAckMode") {
+    noAck = true;
+    return "OK";
+  }
+  if(packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0) {
+    uint32_t offset;
+    uint32_t length;
+    if(sscanf(packet.c_str() + 31, "%x,%x", &offset, &length) != 2) return "E01";
+    string xml = TARGET_XML;
+    if(offset >= xml.size()) return "l";
+    string part = xml.substr(offset, length);
+    return (offset + part.size() < xml.size() ? "m" : "l") + part;
+  }
+  if(packet == "qAttached") return "1";
+  if(packet == "qC") return "QC1";
+  if(packet == "qfThreadInfo") return "m1";
+  if(packet == "qsThreadInfo") return "l";
+  if(kind == 'H' || kind == 'T') return "OK";
+  return "";
+}
+
+// the step ends with the deadline of the next instruction, like the other events of the processor
+void GdbStub::resume(bool step) {
+  emulator->debugAt = step ? emulator->instructionCount + 1 : UINT64_MAX;
+  emulator->updateDeadline();
+  resumePc = emulator->gprs[15];
+  resumeCount = emulator->instructionCount;
+  watchHit = false;
+  waiting = true;
+
+  lock_guard<mutex> lock(watchMutex);
+  interrupted = false;
+  running = true;
+  watchWakeup.notify_one();
+}
+
+// the guest goes on without a debugger and without the cost of one
+void GdbStub::detach() {
+  emulator->decodeCache.clearBreakpoints();
+  watchpoints.clear();
+  updateWatches();
+  emulator->debugAt = UINT64_MAX;
+  emulator->updateDeadline();
+  waiting = false;
+
+  lock_guard<mutex> lock(watchMutex);
+  running = false;
+  close(fd);
+  fd = -1;
+}
+
+// Called by the processor between two instructions for the first stop, the end of a step, a breakpoint,
+// a watchpoint or a byte from gdb, returns once gdb resumes, detaches or kills the guest
+void GdbStub::stop() {
+  {
+    lock_guard<mutex> lock(watchMutex);
+    running = false;
+    char wake = 0;
+    if(polling) write(wakeFds[1], &wake, 1);
+  }
+  emulator->pendingInterrupts.fetch_and(~Emulator::DEBUG_REQUEST);
+  emulator->debugAt = UINT64_MAX;
+  emulator->updateDeadline();
+  if(!connected()) return;
+
+  if(waiting) send(stopReply());
+  waiting = false;
+
+  string packet;
+  while(receive(packet)) {
+    bool resumed = false;
+    string reply = command(packet, resumed);
+    if(resumed) return;
+    send(reply);
+  }
+  detach();
+}
+
+// The run is over, gdb hears about it when it is waiting for the guest
+void GdbStub::exited() {
+  if(connected() && waiting) send("W00");
+  waiting = false;
+}
+
+// Runs on its own thread while gdb is connected, the socket is polled only while the guest runs
+void GdbStub::watching() {
+  unique_lock<mutex> lock(watchMutex);
+  while(!finished) {
+    if(!running) {
+      watchWakeup.wait(lock);
+      continue;
+    }
+
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+    polling = true;
+    lock.unlock();
+    poll(fds, 2, -1);
+    lock.lock();
+    polling = false;
+
+    if(fds[1].revents & POLLIN) {
+      char wake;
+      read(wakeFds[0], &wake, 1);
+    }
+    if(running && (fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+      running = false;
+      interrupted = true;
+      emulator->postInterrupt(Emulator::DEBUG_REQUEST);
+    }
+  }
+}
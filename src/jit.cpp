@@ -0,0 +1,603 @@
+#include "./../inc/jit.hpp"
+#include "./../inc/emulator.hpp"
+
+#include <cstring>
+#include <cstddef>
+#include <sys/mman.h>
+
+// host registers, numbered as in the x86 ModRM byte
+static const int EAX = 0;
+static const int ECX = 1;
+
+static const uint8_t PC = 15;
+static const uint8_t SP = 14;
+
+static_assert(offsetof(Jit::jitState, gprs) == 0, "generated code expects gprs at offset 0");
+static_assert(offsetof(Jit::jitState, instructions) == 0x18, "generated code expects instructions at offset 0x18");
+static_assert(offsetof(Jit::jitState, lastExit) == 0x20, "generated code expects lastExit at offset 0x20");
+static_assert(offsetof(Jit::jitState, budget) == 0x28, "generated code expects budget at offset 0x28");
+static_assert(offsetof(Jit::jitState, pending) == 0x30, "generated code expects pending at offset 0x30");
+static_assert(offsetof(Jit::jitState, enabled) == 0x38, "generated code expects enabled at offset 0x38");
+
+static uint32_t jitRead(Jit::jitState *state, uint32_t address) {
+  return state->emulator->read4Bytes(address);
+}
+
+// returns nonzero when the store hit a translated page, the calling block must not continue
+static uint32_t jitWrite(Jit::jitState *state, uint32_t address, uint32_t value) {
+  state->jit->invalidated = false;
+  state->emulator->write4Bytes(address, value);
+  return state->jit->invalidated;
+}
+
+// instructions that are not translated are executed by the reference interpreter, which sees the count of
+// the instructions retired before them in the block
+static uint32_t jitStep(Jit::jitState *state) {
+  *state->retired += state->instructions;
+  state->instructions = 0;
+  return state->emulator->execute(state->emulator->fetch()) ? Jit::CONTINUE : Jit::HALT;
+}
+
+Jit::Jit(Emulator *emulator, uint32_t *gprs, atomic<uint32_t> *pending) : codePages(1 << (32 - PAGE_BITS), false) {
+  this->emulator = emulator;
+  state = {gprs, this, emulator, 0, nullptr, 0, pending, 0, nullptr};
+}
+
+Jit::~Jit() {
+  if(code) munmap(code, CODE_SIZE);
+}
+
+bool Jit::available() {
+  if(!code) {
+    void *memory = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) return false;
+    code = static_cast<uint8_t *>(memory);
+    codePtr = code;
+  }
+  return true;
+}
+
+// runs until the budget or the limit on instructions is used up, a block only starts when it fits in what is left
+Jit::exitCode Jit::execute(uint32_t pc, uint64_t &instructions, uint64_t limit) {
+  auto it = blocks.find(pc);
+  jitBlock *block = it != blocks.end() ? it->second : translate(pc);
+  if(limit < static_cast<uint64_t>(block->length)) return SHORT_LIMIT;
+
+  // the previous block ended with a static jump to this one, from now on it jumps here directly
+  if(state.lastExit && state.lastExit->target == pc && state.lastExit->from->valid) link(state.lastExit, block);
+
+  state.lastExit = nullptr;
+  state.instructions = 0;
+  state.retired = &instructions;
+  state.budget = limit < static_cast<uint64_t>(BUDGET) ? static_cast<int32_t>(limit) : BUDGET;
+  state.enabled = emulator->enabledInterrupts();
+  uint32_t result = reinterpret_cast<uint32_t (*)(jitState *)>(block->entry)(&state);
+  instructions += state.instructions;
+  return static_cast<exitCode>(result);
+}
+
+void Jit::link(jitExit *exit, jitBlock *target) {
+  int32_t rel = static_cast<int32_t>(target->body - (exit->patchSite + 5));
+  memcpy(exit->patchSite + 1, &rel, 4);
+  target->incoming.push_back(exit);
+}
+
+void Jit::invalidateBlock(jitBlock *block) {
+  block->valid = false;
+  invalidated = true;
+
+  auto it = blocks.find(block->pc);
+  if(it != blocks.end() && it->second == block) blocks.erase(it);
+
+  // code of invalid blocks stays in place until the next flush, only the jumps into it are undone
+  int32_t rel = 0;
+  for(jitExit *exit : block->incoming) {
+    if(exit->from->valid) memcpy(exit->patchSite + 1, &rel, 4);
+  }
+}
+
+void Jit::markLines(codePage &page, jitBlock *block, uint32_t pageNumber) {
+  for(auto &range : block->ranges) {
+    for(uint32_t address = range.first & ~((1 << LINE_BITS) - 1); address < range.second; address += 1 << LINE_BITS) {
+      if(address >> PAGE_BITS != pageNumber) continue;
+      uint32_t line = (address >> LINE_BITS) & 0xFF;
+      page.lines[line >> 6] |= 1ULL << (line & 63);
+    }
+  }
+}
+
+// a store of 4 bytes at address hit a page with translated code
+// a block copy of the host, only the pages with translated code are looked at word by word
+void Jit::invalidate(uint32_t address, size_t size) {
+  if(!size) return;
+  uint64_t end = static_cast<uint64_t>(address) + size;
+  for(uint64_t page = address >> PAGE_BITS; page <= (end - 1) >> PAGE_BITS; page++) {
+    if(!codePages[page]) continue;
+    uint64_t last = min<uint64_t>(end, (page + 1) << PAGE_BITS);
+    for(uint64_t word = max<uint64_t>(address, page << PAGE_BITS); word < last; word += 4) invalidateRange(page, word);
+  }
+}
+
+void Jit::invalidateRange(uint32_t pageNumber, uint32_t address) {
+  auto it = pageBlocks.find(pageNumber);
+  if(it == pageBlocks.end()) return;
+  codePage &page = it->second;
+
+  bool hit = false;
+  for(uint32_t i = 0; i < 4; i++) {
+    if((address + i) >> PAGE_BITS != pageNumber) continue;
+    uint32_t line = ((address + i) >> LINE_BITS) & 0xFF;
+    if(page.lines[line >> 6] >> (line & 63) & 1) hit = true;
+  }
+  if(!hit) return;
+
+  for(jitBlock *block : page.blocks) {
+    if(!block->valid) continue;
+    for(auto &range : block->ranges) {
+      if(address < range.second && address + 4 > range.first) {
+        invalidateBlock(block);
+        break;
+      }
+    }
+  }
+
+  vector<jitBlock *> remaining;
+  memset(page.lines, 0, sizeof(page.lines));
+  for(jitBlock *block : page.blocks) {
+    if(!block->valid) continue;
+    remaining.push_back(block);
+    markLines(page, block, pageNumber);
+  }
+  page.blocks = remaining;
+
+  if(page.blocks.empty()) {
+    pageBlocks.erase(it);
+    codePages[pageNumber] = false;
+  }
+}
+
+void Jit::flush() {
+  blocks.clear();
+  allBlocks.clear();
+  for(auto &page : pageBlocks) codePages[page.first] = false;
+  pageBlocks.clear();
+  codePtr = code;
+  state.lastExit = nullptr;
+}
+
+
+void Jit::emit8(uint8_t value) {
+  *codePtr++ = value;
+}
+
+void Jit::emit32(uint32_t value) {
+  memcpy(codePtr, &value, 4);
+  codePtr += 4;
+}
+
+void Jit::emit64(uint64_t value) {
+  memcpy(codePtr, &value, 8);
+  codePtr += 8;
+}
+
+void Jit::emitEpilogue() {
+  // pop r13; pop r12; pop rbx; ret
+  emit8(0x41); emit8(0x5D);
+  emit8(0x41); emit8(0x5C);
+  emit8(0x5B);
+  emit8(0xC3);
+}
+
+// reads of pc are known at translation time, pc always points to the next instruction
+void Jit::loadGuest(int reg, uint8_t gpr, uint32_t pcNext) {
+  if(gpr == PC) {
+    // mov reg, imm32
+    emit8(0xB8 + reg);
+    emit32(pcNext);
+  } else {
+    // mov reg, [rbx + gpr * 4]
+    emit8(0x8B); emit8(0x43 | reg << 3); emit8(gpr * 4);
+  }
+}
+
+void Jit::storeGuest(uint8_t gpr, int reg) {
+  // mov [rbx + gpr * 4], reg
+  emit8(0x89); emit8(0x43 | reg << 3); emit8(gpr * 4);
+}
+
+void Jit::storeGuestImm(uint8_t gpr, uint32_t value) {
+  // mov dword [rbx + gpr * 4], imm32
+  emit8(0xC7); emit8(0x43); emit8(gpr * 4);
+  emit32(value);
+}
+
+// eax <= gpr[A] + gpr[B] + D
+void Jit::emitAddress(uint8_t A, uint8_t B, int32_t D, uint32_t pcNext) {
+  loadGuest(EAX, A, pcNext);
+  if(B != 0) {
+    loadGuest(ECX, B, pcNext);
+    // add eax, ecx
+    emit8(0x01); emit8(0xC8);
+  }
+  if(D != 0) {
+    // add eax, imm32
+    emit8(0x05);
+    emit32(D);
+  }
+}
+
+void Jit::emitCall(void *function) {
+  // mov rdi, r13; mov rax, imm64; call rax
+  emit8(0x4C); emit8(0x89); emit8(0xEF);
+  emit8(0x48); emit8(0xB8);
+  emit64(reinterpret_cast<uint64_t>(function));
+  emit8(0xFF); emit8(0xD0);
+}
+
+// eax <= mem32[eax]
+void Jit::emitRead() {
+  // mov esi, eax
+  emit8(0x89); emit8(0xC6);
+  emitCall(reinterpret_cast<void *>(jitRead));
+}
+
+// mem32[eax] <= ecx, leaves the block if the store invalidated translated code
+void Jit::emitWrite(int instructions, uint32_t pcNext) {
+  // mov esi, eax; mov edx, ecx
+  emit8(0x89); emit8(0xC6);
+  emit8(0x89); emit8(0xCA);
+  emitCall(reinterpret_cast<void *>(jitWrite));
+
+  // test eax, eax; jz skip
+  emit8(0x85); emit8(0xC0);
+  emit8(0x74); emit8(0);
+  uint8_t *skip = codePtr;
+  emitCounters(instructions);
+  storeGuestImm(PC, pcNext);
+  emitDynamicExit(CONTINUE);
+  skip[-1] = static_cast<uint8_t>(codePtr - skip);
+}
+
+void Jit::emitCounters(int instructions) {
+  if(instructions == 0) return;
+  // add qword [r13 + instructions], imm8; sub dword [r13 + budget], imm8
+  emit8(0x49); emit8(0x83); emit8(0x45); emit8(0x18); emit8(instructions);
+  emit8(0x41); emit8(0x83); emit8(0x6D); emit8(0x28); emit8(instructions);
+}
+
+// exit with a target known at translation time, the jmp is patched once the target block exists
+void Jit::emitExit(jitBlock *block, int instructions, uint32_t target) {
+  emitCounters(instructions);
+  storeGuestImm(PC, target);
+
+  uint8_t *patchSite = codePtr;
+  // jmp rel32, falls through until linked
+  emit8(0xE9);
+  emit32(0);
+
+  block->exits.push_back({patchSite, target, block});
+  // mov rax, imm64; mov [r13 + lastExit], rax; xor eax, eax
+  emit8(0x48); emit8(0xB8);
+  emit64(reinterpret_cast<uint64_t>(&block->exits.back()));
+  emit8(0x49); emit8(0x89); emit8(0x45); emit8(0x20);
+  emit8(0x31); emit8(0xC0);
+  emitEpilogue();
+}
+
+// exit with pc already stored by the generated code
+void Jit::emitDynamicExit(int result) {
+  // mov qword [r13 + lastExit], 0; mov eax, imm32
+  emit8(0x49); emit8(0xC7); emit8(0x45); emit8(0x20); emit32(0);
+  emit8(0xB8);
+  emit32(result);
+  emitEpilogue();
+}
+
+void Jit::emitFallback(int instructions, uint32_t pc) {
+  emitCounters(instructions);
+  storeGuestImm(PC, pc);
+  emitCall(reinterpret_cast<void *>(jitStep));
+  // mov qword [r13 + lastExit], 0, eax is the result of jitStep
+  emit8(0x49); emit8(0xC7); emit8(0x45); emit8(0x20); emit32(0);
+  emitEpilogue();
+}
+
+
+// the block depends on the 4 bytes at address
+void Jit::addRange(jitBlock *block, uint32_t address) {
+  if(!block->ranges.empty()) {
+    auto &last = block->ranges.back();
+    if(address >= last.first && address <= last.second) {
+      if(address + 4 > last.second) last.second = address + 4;
+      return;
+    }
+  }
+  block->ranges.push_back({address, address + 4});
+}
+
+// pc relative literals of the expanded ld $lit, call sym, jmp sym... are constants while their page isn't written to
+bool Jit::foldLiteral(jitBlock *block, uint32_t address, uint32_t &value) {
+  if(emulator->devices.mayHit(address)) return false;
+  addRange(block, address);
+  value = emulator->read4Bytes(address);
+  return true;
+}
+
+Jit::jitBlock *Jit::translate(uint32_t pc) {
+  if(codePtr + BLOCK_RESERVE > code + CODE_SIZE) flush();
+
+  allBlocks.push_back(unique_ptr<jitBlock>(new jitBlock()));
+  jitBlock *block = allBlocks.back().get();
+  block->pc = pc;
+  block->valid = true;
+  block->entry = codePtr;
+
+  // push rbx; push r12; push r13; mov r13, rdi; mov rbx, [r13 + gprs]
+  emit8(0x53);
+  emit8(0x41); emit8(0x54);
+  emit8(0x41); emit8(0x55);
+  emit8(0x49); emit8(0x89); emit8(0xFD);
+  emit8(0x49); emit8(0x8B); emit8(0x5D); emit8(0x00);
+  // jmp start, the dispatcher has just checked the interrupts
+  emit8(0xEB); emit8(0);
+  uint8_t *checks = codePtr;
+
+  // chained blocks jump here and go back to the dispatcher if an enabled interrupt is pending or the budget
+  // doesn't cover the whole block
+  block->body = codePtr;
+  // cmp dword [r13 + budget], length; jl bail
+  emit8(0x41); emit8(0x81); emit8(0x7D); emit8(0x28); emit32(0);
+  uint8_t *lengthSite = codePtr - 4;
+  emit8(0x7C); emit8(0);
+  uint8_t *budgetSpent = codePtr;
+  // mov rax, [r13 + pending]; mov eax, [rax]; and eax, [r13 + enabled]; jz start
+  emit8(0x49); emit8(0x8B); emit8(0x45); emit8(0x30);
+  emit8(0x8B); emit8(0x00);
+  emit8(0x41); emit8(0x23); emit8(0x45); emit8(0x38);
+  emit8(0x74); emit8(0);
+  uint8_t *noInterrupt = codePtr;
+  budgetSpent[-1] = static_cast<uint8_t>(codePtr - budgetSpent);
+  storeGuestImm(PC, pc);
+  emitDynamicExit(CONTINUE);
+  noInterrupt[-1] = static_cast<uint8_t>(codePtr - noInterrupt);
+  checks[-1] = static_cast<uint8_t>(codePtr - checks);
+
+  uint32_t current = pc;
+  bool done = false;
+  for(int count = 0; !done; count++, current += 4) {
+    if(count == MAX_BLOCK_INSTRUCTIONS) {
+      emitExit(block, count, current);
+      break;
+    }
+    block->length = count + 1;
+
+    addRange(block, current);
+    DecodeCache::decodedInstruction decoded = DecodeCache::decode(current, emulator->read4Bytes(current));
+    uint8_t A = decoded.A;
+    uint8_t B = decoded.B;
+    uint8_t C = decoded.C;
+    int32_t D = decoded.D;
+    uint32_t next = current + 4;
+    int executed = count + 1;
+    uint32_t literal;
+
+    switch(decoded.op) {
+      case 0x50: case 0x51: case 0x52: case 0x53:
+      case 0x60: case 0x61: case 0x62: case 0x63:
+      case 0x70: case 0x71:
+        if(A == PC) {
+          emitFallback(count, current);
+          done = true;
+          break;
+        }
+        if(A == 0) break;
+        loadGuest(EAX, B, next);
+        loadGuest(ECX, C, next);
+        switch(decoded.op) {
+          case 0x50: emit8(0x01); emit8(0xC8); break;                         // add eax, ecx
+          case 0x51: emit8(0x29); emit8(0xC8); break;                         // sub eax, ecx
+          case 0x52: emit8(0x0F); emit8(0xAF); emit8(0xC1); break;            // imul eax, ecx
+          case 0x53: emit8(0x31); emit8(0xD2); emit8(0xF7); emit8(0xF1); break; // xor edx, edx; div ecx
+          case 0x60: emit8(0xF7); emit8(0xD0); break;                         // not eax
+          case 0x61: emit8(0x21); emit8(0xC8); break;                         // and eax, ecx
+          case 0x62: emit8(0x09); emit8(0xC8); break;                         // or eax, ecx
+          case 0x63: emit8(0x31); emit8(0xC8); break;                         // xor eax, ecx
+          case 0x70: emit8(0xD3); emit8(0xE0); break;                         // shl eax, cl
+          case 0x71: emit8(0xD3); emit8(0xE8); break;                         // shr eax, cl
+        }
+        storeGuest(A, EAX);
+        break;
+      case 0x40:
+        if(B == PC || C == PC) {
+          emitFallback(count, current);
+          done = true;
+          break;
+        }
+        if(B == 0 || C == 0) break;
+        loadGuest(EAX, B, next);
+        loadGuest(ECX, C, next);
+        storeGuest(B, ECX);
+        storeGuest(C, EAX);
+        break;
+      case 0x80:
+        emitAddress(A, B, D, next);
+        loadGuest(ECX, C, next);
+        emitWrite(executed, next);
+        break;
+      case 0x81:
+        if(A == PC) {
+          emitFallback(count, current);
+          done = true;
+          break;
+        }
+        if(A == 0) break;
+        emitAddress(A, 0, D, next);
+        storeGuest(A, EAX);
+        loadGuest(ECX, C, next);
+        emitWrite(executed, next);
+        break;
+      case 0x82:
+        if(A == PC && B == 0 && foldLiteral(block, next + D, literal)) {
+          // mov eax, imm32
+          emit8(0xB8);
+          emit32(literal);
+        } else {
+          emitAddress(A, B, D, next);
+          emitRead();
+        }
+        loadGuest(ECX, C, next);
+        emitWrite(executed, next);
+        break;
+      case 0x91:
+        if(A == PC) {
+          emitFallback(count, current);
+          done = true;
+          break;
+        }
+        if(A == 0) break;
+        emitAddress(B, 0, D, next);
+        storeGuest(A, EAX);
+        break;
+      case 0x92:
+        if(A == 0) break;
+        if(B == PC && C == 0 && foldLiteral(block, next + D, literal)) {
+          if(A == PC) {
+            emitExit(block, executed, literal);
+            done = true;
+          } else storeGuestImm(A, literal);
+          break;
+        }
+        emitAddress(B, C, D, next);
+        emitRead();
+        storeGuest(A, EAX);
+        if(A == PC) {
+          emitCounters(executed);
+          emitDynamicExit(CONTINUE);
+          done = true;
+        }
+        break;
+      case 0x93:
+        if(A == 0 || B == 0) break;
+        if(B == PC) {
+          emitFallback(count, current);
+          done = true;
+          break;
+        }
+        loadGuest(EAX, B, next);
+        emitRead();
+        storeGuest(A, EAX);
+        // add dword [rbx + B * 4], imm32
+        emit8(0x81); emit8(0x43); emit8(B * 4);
+        emit32(D);
+        if(A == PC) {
+          emitCounters(executed);
+          emitDynamicExit(CONTINUE);
+          done = true;
+        }
+        break;
+      case 0x30:
+      case 0x38:
+        done = true;
+        if(A == PC && decoded.op == 0x30) {
+          emitExit(block, executed, next + D);
+          break;
+        }
+        if(A == PC && foldLiteral(block, next + D, literal)) {
+          emitExit(block, executed, literal);
+          break;
+        }
+        emitAddress(A, 0, D, next);
+        if(decoded.op == 0x38) emitRead();
+        storeGuest(PC, EAX);
+        emitCounters(executed);
+        emitDynamicExit(CONTINUE);
+        break;
+      case 0x31: case 0x32: case 0x33:
+      case 0x39: case 0x3A: case 0x3B: {
+        done = true;
+        loadGuest(EAX, B, next);
+        loadGuest(ECX, C, next);
+        // cmp eax, ecx; jcc rel32 to the not taken exit
+        emit8(0x39); emit8(0xC8);
+        emit8(0x0F);
+        switch(decoded.op & 0x3) {
+          case 1: emit8(0x85); break; // jne
+          case 2: emit8(0x84); break; // je
+          case 3: emit8(0x8E); break; // jle
+        }
+        emit32(0);
+        uint8_t *notTaken = codePtr;
+
+        bool memory = decoded.op & 0x8;
+        if(A == PC && !memory) emitExit(block, executed, next + D);
+        else if(A == PC && foldLiteral(block, next + D, literal)) emitExit(block, executed, literal);
+        else {
+          emitAddress(A, 0, D, next);
+          if(memory) emitRead();
+          storeGuest(PC, EAX);
+          emitCounters(executed);
+          emitDynamicExit(CONTINUE);
+        }
+
+        int32_t rel = static_cast<int32_t>(codePtr - notTaken);
+        memcpy(notTaken - 4, &rel, 4);
+        emitExit(block, executed, next);
+        break;
+      }
+      case 0x20:
+      case 0x21: {
+        done = true;
+        // push pc, r12 keeps the result of the store
+        loadGuest(EAX, SP, next);
+        emit8(0x83); emit8(0xE8); emit8(0x04); // sub eax, 4
+        storeGuest(SP, EAX);
+        emit8(0xB9); emit32(next);             // mov ecx, imm32
+        emit8(0x89); emit8(0xC6);              // mov esi, eax
+        emit8(0x89); emit8(0xCA);              // mov edx, ecx
+        emitCall(reinterpret_cast<void *>(jitWrite));
+        emit8(0x41); emit8(0x89); emit8(0xC4); // mov r12d, eax
+        emitCounters(executed);
+
+        // test r12d, r12d; jz rel32, if the push hit translated code the target is read again
+        emit8(0x45); emit8(0x85); emit8(0xE4);
+        emit8(0x0F); emit8(0x84);
+        emit32(0);
+        uint8_t *fast = codePtr;
+        emitAddress(A, B, D, next);
+        if(decoded.op == 0x21) emitRead();
+        storeGuest(PC, EAX);
+        emitDynamicExit(CONTINUE);
+        int32_t rel = static_cast<int32_t>(codePtr - fast);
+        memcpy(fast - 4, &rel, 4);
+
+        if(A == PC && B == 0 && decoded.op == 0x20) emitExit(block, 0, next + D);
+        else if(A == PC && B == 0 && foldLiteral(block, next + D, literal)) emitExit(block, 0, literal);
+        else {
+          emitAddress(A, B, D, next);
+          if(decoded.op == 0x21) emitRead();
+          storeGuest(PC, EAX);
+          emitDynamicExit(CONTINUE);
+        }
+        break;
+      }
+      default:
+        // halt, int, csr access and unknown instructions
+        emitFallback(count, current);
+        done = true;
+        break;
+    }
+  }
+
+  memcpy(lengthSite, &block->length, 4);
+  blocks[pc] = block;
+  for(auto &range : block->ranges) {
+    for(uint32_t address = range.first & ~Memory::PAGE_MASK; address < range.second; address += Memory::PAGE_SIZE) {
+      codePage &page = pageBlocks[address >> PAGE_BITS];
+      if(!page.blocks.empty() && page.blocks.back() == block) continue;
+      page.blocks.push_back(block);
+      markLines(page, block, address >> PAGE_BITS);
+      codePages[address >> PAGE_BITS] = true;
+    }
+  }
+  return block;
+}
@@ -1,23 +1,197 @@
 #include <stdio.h>
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
 
 #include "./../inc/emulator.hpp"
+#include "./../inc/batch.hpp"
+
+#include <fstream>
+#include <thread>
+#include <chrono>
+#include <iomanip>
+
+// <size>:<line>:<ways>, all in bytes but the ways
+bool parseCache(const char *text, cacheGeometry &geometry) {
+  char rest;
+  if(sscanf(text, "%u:%u:%u%c", &geometry.size, &geometry.line, &geometry.ways, &rest) != 3) return false;
+  return Cache::valid(geometry);
+}
+
+bool parseArgs(int argc, char *argv[], string &inputFile, emulatorOptions &options, string &batchFile, unsigned &threads) {
+  for(int i = 1; i < argc; i++) {
+    if(string(argv[i]).find("-engine=") == 0) {
+      string engine = string(argv[i]).substr(8);
+      if(engine == "switch") options.engine = SWITCH_ENGINE;
+      else if(engine == "threaded") options.engine = THREADED_ENGINE;
+      else if(engine == "jit") options.engine = JIT_ENGINE;
+      else {
+        cout << "Invalid -engine argument: " << argv[i] << endl;
+        return false;
+      }
+    } else if(strcmp(argv[i], "-mips") == 0) {
+      options.mips = true;
+    } else if(strcmp(argv[i], "-footprint") == 0) {
+      options.footprint = true;
+    } else if(strcmp(argv[i], "-no-fusion") == 0) {
+      options.fusion = false;
+    } else if(strcmp(argv[i], "-profile") == 0) {
+      options.profile = "profile";
+    } else if(string(argv[i]).find("-profile=") == 0) {
+      options.profile = string(argv[i]).substr(9);
+      if(options.profile.empty()) {
+        cout << "Invalid -profile argument: " << argv[i] << endl;
+        return false;
+      }
+    } else if(strcmp(argv[i], "-stats") == 0) {
+      options.stats = "stats.json";
+    } else if(string(argv[i]).find("-stats=") == 0) {
+      options.stats = string(argv[i]).substr(7);
+      if(options.stats.empty()) {
+        cout << "Invalid -stats argument: " << argv[i] << endl;
+        return false;
+      }
+    } else if(string(argv[i]).find("-trace=") == 0) {
+      options.trace = string(argv[i]).substr(7);
+      if(options.trace.empty()) {
+        cout << "Invalid -trace argument: " << argv[i] << endl;
+        return false;
+      }
+    } else if(string(argv[i]).find("-icache=") == 0 || string(argv[i]).find("-dcache=") == 0) {
+      if(!parseCache(argv[i] + 8, argv[i][1] == 'i' ? options.icache : options.dcache)) {
+        cout << "Invalid " << string(argv[i]).substr(0, 7) << " argument: " << argv[i] << endl;
+        return false;
+      }
+    } else if(string(argv[i]).find("-cache-report=") == 0) {
+      options.cacheReport = string(argv[i]).substr(14);
+      if(options.cacheReport.empty()) {
+        cout << "Invalid -cache-report argument: " << argv[i] << endl;
+        return false;
+      }
+    } else if(string(argv[i]).find("-gdb=") == 0) {
+      options.gdb = string(argv[i]).substr(5);
+      if(options.gdb.empty()) {
+        cout << "Invalid -gdb argument: " << argv[i] << endl;
+        return false;
+      }
+    } else if(string(argv[i]).find("-save=") == 0) {
+      string save = string(argv[i]).substr(6);
+      size_t at = save.rfind('@');
+      if(at == string::npos || at == 0 || at + 1 == save.size()) {
+        cout << "Invalid -save argument: " << argv[i] << endl;
+        return false;
+      }
+      options.saveFile = save.substr(0, at);
+      options.saveAt = strtoull(save.c_str() + at + 1, nullptr, 10);
+    } else if(string(argv[i]).find("-batch=") == 0) {
+      batchFile = string(argv[i]).substr(7);
+    } else if(string(argv[i]).find("-threads=") == 0) {
+      threads = strtoul(argv[i] + 9, nullptr, 10);
+      if(threads == 0) {
+        cout << "Invalid -threads argument: " << argv[i] << endl;
+        return false;
+      }
+    } else if(string(argv[i]).find("-limit=") == 0) {
+      options.maxInstructions = strtoull(argv[i] + 7, nullptr, 10);
+    } else if(string(argv[i]).find("-restore=") == 0) {
+      options.restoreFile = string(argv[i]).substr(9);
+    } else if(strcmp(argv[i], "-virtual-time") == 0) {
+      options.virtualTime = true;
+    } else if(string(argv[i]).find("-virtual-time=") == 0) {
+      options.virtualTime = true;
+      options.instructionsPerMs = strtoull(argv[i] + 14, nullptr, 10);
+      if(options.instructionsPerMs == 0) {
+        cout << "Invalid -virtual-time argument: " << argv[i] << endl;
+        return false;
+      }
+    } else if(string(argv[i]).find("-cores=") == 0) {
+      options.cores = strtoul(argv[i] + 7, nullptr, 10);
+      if(options.cores == 0 || options.cores > Emulator::MAX_CORES) {
+        cout << "Invalid -cores argument: " << argv[i] << endl;
+        return false;
+      }
+    } else if(inputFile.empty()) {
+      inputFile = string(argv[i]);
+    } else {
+      return false;
+    }
+  }
+  if(options.cores > 1 && (options.virtualTime || !options.profile.empty() || !options.saveFile.empty() || !options.restoreFile.empty() || !batchFile.empty())) {
+    cout << "-cores can't be combined with -virtual-time, -profile, -save, -restore or -batch" << endl;
+    return false;
+  }
+  if((!options.trace.empty() || !options.stats.empty()) && !batchFile.empty()) {
+    cout << "-trace and -stats can't be combined with -batch" << endl;
+    return false;
+  }
+  // every run of a batch would write the same file and the runs restore the checkpoint of their image
+  if((!options.profile.empty() || !options.saveFile.empty() || !options.restoreFile.empty()) && !batchFile.empty()) {
+    cout << "-profile, -save and -restore can't be combined with -batch" << endl;
+    return false;
+  }
+  if(!options.gdb.empty() && (options.cores > 1 || !batchFile.empty())) {
+    cout << "-gdb can't be combined with -cores or -batch" << endl;
+    return false;
+  }
+  if((options.icache.size || options.dcache.size) && (options.cores > 1 || !batchFile.empty())) {
+    cout << "-icache and -dcache can't be combined with -cores or -batch" << endl;
+    return false;
+  }
+  if(inputFile.empty()) inputFile = options.restoreFile;
+  return !inputFile.empty() || !batchFile.empty();
+}
+
+// every line of the list is a hex image, results are printed in the order of the list
+int runBatch(const string &batchFile, emulatorOptions options, unsigned threads) {
+  ifstream list(batchFile);
+  if(!list.is_open()) {
+    cout << "Opening file error" << endl;
+    return 1;
+  }
+
+  vector<string> images;
+  string line;
+  while(getline(list, line)) {
+    if(!line.empty()) images.push_back(line);
+  }
+
+  auto start = chrono::steady_clock::now();
+  BatchRunner runner(images, options);
+  runner.run(threads);
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  for(auto &result : runner.getResults()) {
+    cout << "== " << result.image << " (" << fixed << setprecision(3) << result.seconds << " s)\n";
+    cout << result.output;
+  }
+  cout << "Ran " << images.size() << " images on " << threads << " threads in " << fixed << setprecision(3) << elapsed.count() << " s" << endl;
+  return 0;
+}
 
 int main(int argc, char* argv[]) {
-  if(argc < 2 || string(argv[0]) != "./../../build/emulator") {
-    cout << "Call program like this: ./../../build/emulator <input_file>\n" << endl;
+  string inputFile;
+  emulatorOptions options;
+  string batchFile;
+  unsigned threads = thread::hardware_concurrency();
+  if(threads == 0) threads = 1;
+
+  if(argc < 2 || string(argv[0]) != "./../../build/emulator" || !parseArgs(argc, argv, inputFile, options, batchFile, threads)) {
+    cout << "Call program like this: ./../../build/emulator [-engine=switch, -engine=threaded or -engine=jit] [-mips] [-footprint] [-no-fusion] [-virtual-time[=<instructions per ms>]] [-profile[=<file prefix>]] [-trace=<file>] [-stats[=<file>]] [-gdb=<port or socket path>] [-icache=<size>:<line>:<ways>] [-dcache=<size>:<line>:<ways>] [-cache-report=<file>] [-save=<file>@<instructions>] [-restore=<file>] [-limit=<instructions>] [-cores=<n>] <input_file>\n"
+            "or like this: ./../../build/emulator -batch=<file with one image per line> [-threads=<n>] [options above]\n" << endl;
     return 1;
   }
 
-  FILE *f = fopen(argv[1], "r");
+  if(!batchFile.empty()) return runBatch(batchFile, options, threads);
+
+  FILE *f = fopen(inputFile.c_str(), "r");
   if(!f) {
     cout << "Opening file error" << endl;
     return 1;
   }
 
-  Emulator *emulator = new Emulator(argv[1]);
+  Emulator *emulator = new Emulator(&inputFile[0], options);
   emulator->emulate();
   delete emulator;
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <iostream>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+#include "./../inc/trace.hpp"
+
+using namespace std;
+
+static string reg(uint32_t index) {
+  return "%r" + to_string(index);
+}
+
+static string csr(uint32_t index) {
+  static const char *names[] = {"%status", "%handler", "%cause", "%coreid"};
+  return index < 4 ? names[index] : "%csr" + to_string(index);
+}
+
+// operands as the processor uses them, not the assembler syntax that produced the instruction
+static string disassemble(uint32_t word) {
+  uint32_t op = word >> 24;
+  uint32_t A = (word >> 20) & 0xF;
+  uint32_t B = (word >> 16) & 0xF;
+  uint32_t C = (word >> 12) & 0xF;
+  int32_t D = word & 0xFFF;
+  if(D & 0x800) D |= 0xFFFFF000;
+  string d = to_string(D);
+
+  static const char *arithmetic[] = {"add", "sub", "mul", "div", "not", "and", "or", "xor"};
+  static const char *branches[] = {"jmp", "beq", "bne", "bgt"};
+  switch(op) {
+    case 0x00: return "halt";
+    case 0x10: return "int";
+    case 0x20: return "call " + reg(A) + " + " + reg(B) + " + " + d;
+    case 0x21: return "call [" + reg(A) + " + " + reg(B) + " + " + d + "]";
+    case 0x30: return "jmp " + reg(A) + " + " + d;
+    case 0x31: case 0x32: case 0x33:
+      return string(branches[op & 3]) + " " + reg(B) + ", " + reg(C) + ", " + reg(A) + " + " + d;
+    case 0x38: return "jmp [" + reg(A) + " + " + d + "]";
+    case 0x39: case 0x3A: case 0x3B:
+      return string(branches[op & 3]) + " " + reg(B) + ", " + reg(C) + ", [" + reg(A) + " + " + d + "]";
+    case 0x40: return "xchg " + reg(B) + ", " + reg(C);
+    case 0x50: case 0x51: case 0x52: case 0x53: case 0x61: case 0x62: case 0x63:
+      return string(arithmetic[(op >> 4 == 6 ? 4 : 0) + (op & 3)]) + " " + reg(A) + ", " + reg(B) + ", " + reg(C);
+    case 0x60: return "not " + reg(A) + ", " + reg(B);
+    case 0x70: return "shl " + reg(A) + ", " + reg(B) + ", " + reg(C);
+    case 0x71: return "shr " + reg(A) + ", " + reg(B) + ", " + reg(C);
+    case 0x80: return "st [" + reg(A) + " + " + reg(B) + " + " + d + "], " + reg(C);
+    case 0x81: return "st [" + reg(A) + " += " + d + "], " + reg(C);
+    case 0x82: return "st [[" + reg(A) + " + " + reg(B) + " + " + d + "]], " + reg(C);
+    case 0x90: return "ld " + reg(A) + ", " + csr(B);
+    case 0x91: return "ld " + reg(A) + ", " + reg(B) + " + " + d;
+    case 0x92: return "ld " + reg(A) + ", [" + reg(B) + " + " + reg(C) + " + " + d + "]";
+    case 0x93: return "ld " + reg(A) + ", [" + reg(B) + "], " + reg(B) + " += " + d;
+    case 0x94: return "ld " + csr(A) + ", " + reg(B);
+    case 0x95: return "ld " + csr(A) + ", " + csr(B) + " + " + d;
+    case 0x96: return "ld " + csr(A) + ", [" + reg(B) + " + " + reg(C) + " + " + d + "]";
+    case 0x97: return "ld " + csr(A) + ", [" + reg(B) + "], " + reg(B) + " += " + d;
+    default: return "unknown";
+  }
+}
+
+static string hex32(uint32_t value) {
+  ostringstream oss;
+  oss << "0x" << hex << setw(8) << setfill('0') << value;
+  return oss.str();
+}
+
+int main(int argc, char* argv[]) {
+  bool csv = false;
+  string inputFile;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-csv") == 0) csv = true;
+    else if(inputFile.empty()) inputFile = argv[i];
+    else inputFile.clear(), i = argc;
+  }
+
+  if(inputFile.empty()) {
+    cout << "Call program like this: ./tracedecoder [-csv] <trace file>" << endl;
+    return 1;
+  }
+
+  TraceReader reader(inputFile);
+  if(!reader.good()) {
+    cout << "Opening file error" << endl;
+    return 1;
+  }
+
+  // stores and interrupts belong to the instruction before them, the interrupt entry's pushes follow the interrupt
+  uint64_t index = 0;
+  uint32_t pc = 0;
+  Tracer::traceEvent event;
+  if(csv) cout << "event,index,pc,instruction,text,address,value\n";
+  while(reader.next(event)) {
+    if(event.kind == Tracer::INSTRUCTION) {
+      index++;
+      pc = event.first;
+      if(csv) cout << "instruction," << index << "," << hex32(pc) << "," << hex32(event.second) << ",\"" << disassemble(event.second) << "\",,\n";
+      else cout << setw(12) << dec << index << "  " << hex32(pc) << "  " << hex32(event.second) << "  " << disassemble(event.second) << "\n";
+    } else if(event.kind == Tracer::STORE) {
+      if(csv) cout << "store," << index << "," << hex32(pc) << ",,," << hex32(event.first) << "," << hex32(event.second) << "\n";
+      else cout << setw(12) << "" << "    store " << hex32(event.second) << " to " << hex32(event.first) << "\n";
+    } else {
+      if(csv) cout << "interrupt," << index << "," << hex32(pc) << ",,cause " << dec << event.first << ",," << hex32(event.second) << "\n";
+      else cout << setw(12) << "" << "    interrupt, cause " << dec << event.first << (event.first == 3 ? ", input " + hex32(event.second) : "") << "\n";
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include "./../inc/memory.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <sys/mman.h>
+
+// huge pages would commit 2 MiB for a guest that touches one page of them
+Memory::Memory() {
+  void *reserved = mmap(nullptr, SPACE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  base = reserved == MAP_FAILED ? nullptr : static_cast<uint8_t *>(reserved);
+  if(base) madvise(base, SPACE_SIZE, MADV_NOHUGEPAGE);
+}
+
+Memory::~Memory() {
+  if(base) munmap(base, SPACE_SIZE);
+}
+
+// a block past the last address goes on at address 0
+void Memory::writeBlock(uint32_t address, const uint8_t *data, size_t size) {
+  while(size > 0) {
+    size_t chunk = min<uint64_t>(size, SPACE_SIZE - address);
+    memcpy(base + address, data, chunk);
+    address += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+// The callers keep both ranges inside the address space, overlapping ranges are copied like memmove
+void Memory::copyBlock(uint32_t destination, uint32_t source, size_t size) {
+  memmove(base + destination, base + source, size);
+}
+
+// The callers keep the range inside the address space, whole pages of a zero fill are given back to the host;
+// they are replaced with fresh anonymous pages, a page mapped from a checkpoint would be read from the file again
+void Memory::fillBlock(uint32_t address, uint8_t value, size_t size) {
+  uint64_t end = static_cast<uint64_t>(address) + size;
+  uint64_t firstPage = (static_cast<uint64_t>(address) + PAGE_MASK) & ~static_cast<uint64_t>(PAGE_MASK);
+  uint64_t lastPage = end & ~static_cast<uint64_t>(PAGE_MASK);
+  if(value || firstPage >= lastPage) {
+    memset(base + address, value, size);
+    return;
+  }
+
+  memset(base + address, 0, firstPage - address);
+  void *zero = mmap(base + firstPage, lastPage - firstPage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+  if(zero == MAP_FAILED) {
+    memset(base + firstPage, 0, lastPage - firstPage);
+  } else {
+    madvise(zero, lastPage - firstPage, MADV_NOHUGEPAGE);
+    if(!filePages.empty()) fill(filePages.begin() + (firstPage >> PAGE_BITS), filePages.begin() + (lastPage >> PAGE_BITS), false);
+  }
+  memset(base + lastPage, 0, end - lastPage);
+}
+
+vector<uint32_t> Memory::touchedPages() const {
+  static const uint64_t CHUNK = static_cast<uint64_t>(1) << 28;
+  vector<uint32_t> pages;
+  vector<unsigned char> resident(CHUNK >> PAGE_BITS);
+  for(uint64_t start = 0; base && start < SPACE_SIZE; start += CHUNK) {
+    if(mincore(base + start, CHUNK, resident.data()) != 0) continue;
+    for(size_t i = 0; i < resident.size(); i++) {
+      uint64_t address = start + (i << PAGE_BITS);
+      bool mapped = !filePages.empty() && filePages[address >> PAGE_BITS];
+      if(mapped || (resident[i] & 1)) pages.push_back(address);
+    }
+  }
+  return pages;
+}
+
+// the reservation may be split into several mappings by a restored checkpoint, their Rss lines are added up
+size_t Memory::residentBytes() const {
+  ifstream maps("/proc/self/smaps");
+  uintptr_t low = reinterpret_cast<uintptr_t>(base);
+  uintptr_t high = low + SPACE_SIZE;
+  bool inside = false;
+  size_t kilobytes = 0;
+
+  string line;
+  while(getline(maps, line)) {
+    unsigned long start;
+    unsigned long end;
+    size_t value;
+    if(sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2 && line.find(':') > line.find(' ')) inside = start >= low && end <= high;
+    else if(inside && sscanf(line.c_str(), "Rss: %zu kB", &value) == 1) kilobytes += value;
+  }
+  return kilobytes << 10;
+}
+
+// Pages of a file mapped privately in place of the guest pages, they are read from it on first use and copied on first write
+bool Memory::mapFile(int fd, size_t offset, uint32_t address, size_t size) {
+  if(!base || address + static_cast<uint64_t>(size) > SPACE_SIZE) return false;
+  if(mmap(base + address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED) return false;
+  if(filePages.empty()) filePages.resize(SPACE_SIZE >> PAGE_BITS);
+  uint64_t firstPage = address >> PAGE_BITS;
+  fill(filePages.begin() + firstPage, filePages.begin() + firstPage + ((size + PAGE_MASK) >> PAGE_BITS), true);
+  return true;
+}
@@ -0,0 +1,126 @@
+#include "./../inc/profiler.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+Profiler::Profiler(uint32_t entry) {
+  for(uint32_t i = 0; i < TABLE_SIZE; i++) directory[i] = nullptr;
+  stacks.push_back({0, entry, 0});
+}
+
+Profiler::~Profiler() {
+  for(uint32_t i = 0; i < TABLE_SIZE; i++) {
+    if(!directory[i]) continue;
+    for(uint32_t j = 0; j < TABLE_SIZE; j++) delete[] directory[i][j];
+    delete[] directory[i];
+  }
+}
+
+uint64_t *Profiler::allocatePage(uint32_t pc) {
+  uint64_t **&table = directory[pc >> (PAGE_BITS + TABLE_BITS)];
+  if(!table) table = new uint64_t*[TABLE_SIZE]();
+
+  uint64_t *&page = table[(pc >> PAGE_BITS) & TABLE_MASK];
+  page = new uint64_t[PAGE_SLOTS]();
+  return page;
+}
+
+// calls and interrupts enter a function, the handler is a function called from wherever it interrupted
+void Profiler::call(uint32_t function) {
+  auto it = children.find({current, function});
+  if(it != children.end()) {
+    current = it->second;
+    return;
+  }
+
+  uint32_t node = stacks.size();
+  stacks.push_back({current, function, 0});
+  children[{current, function}] = node;
+  current = node;
+}
+
+// ret and iret, a return past the entry stays at the entry
+void Profiler::ret() {
+  current = stacks[current].parent;
+}
+
+string Profiler::stackName(uint32_t node) {
+  ostringstream oss;
+  oss << "0x" << hex << setw(8) << setfill('0') << stacks[node].function;
+  if(node == 0) return oss.str();
+  return stackName(stacks[node].parent) + ";" + oss.str();
+}
+
+// halt, int, calls, jumps and loads into pc
+static bool endsBlock(uint32_t instruction) {
+  uint8_t OC = instruction >> 28;
+  uint8_t MOD = (instruction >> 24) & 0xF;
+  uint8_t A = (instruction >> 20) & 0xF;
+  return OC <= 3 || (OC == 9 && MOD >= 1 && MOD <= 3 && A == 15);
+}
+
+// <prefix>.txt has the hot spots by pc and by basic block, <prefix>.folded has one line per calling context
+bool Profiler::write(const string &prefix, const Memory &memory) {
+  vector<pair<uint32_t, uint64_t>> pcs;
+  uint64_t total = 0;
+  for(uint32_t i = 0; i < TABLE_SIZE; i++) {
+    if(!directory[i]) continue;
+    for(uint32_t j = 0; j < TABLE_SIZE; j++) {
+      uint64_t *page = directory[i][j];
+      if(!page) continue;
+      for(uint32_t k = 0; k < PAGE_SLOTS; k++) {
+        if(!page[k]) continue;
+        pcs.push_back({(i << (PAGE_BITS + TABLE_BITS)) | (j << PAGE_BITS) | (k << 2), page[k]});
+        total += page[k];
+      }
+    }
+  }
+
+  // consecutive pcs with the same count are one block until a control transfer
+  struct basicBlock {
+    uint32_t start;
+    uint32_t length;
+    uint64_t count;
+  };
+  vector<basicBlock> blocks;
+  for(size_t i = 0; i < pcs.size(); i++) {
+    bool extends = i > 0 && pcs[i].first == pcs[i - 1].first + 4 && pcs[i].second == pcs[i - 1].second && !endsBlock(memory.read32(pcs[i - 1].first));
+    if(extends) blocks.back().length++;
+    else blocks.push_back({pcs[i].first, 1, pcs[i].second});
+  }
+
+  ofstream report(prefix + ".txt");
+  ofstream folded(prefix + ".folded");
+  if(!report.is_open() || !folded.is_open()) return false;
+
+  sort(pcs.begin(), pcs.end(), [](const pair<uint32_t, uint64_t> &a, const pair<uint32_t, uint64_t> &b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+  });
+  sort(blocks.begin(), blocks.end(), [](const basicBlock &a, const basicBlock &b) {
+    return a.count * a.length != b.count * b.length ? a.count * a.length > b.count * b.length : a.start < b.start;
+  });
+
+  report << "Retired instructions: " << total << "\n\n";
+  report << "Hot spots by pc\n";
+  report << "        pc  instruction            count        %\n";
+  for(auto &pc : pcs) {
+    report << "0x" << hex << setw(8) << setfill('0') << pc.first << "   0x" << setw(8) << memory.read32(pc.first);
+    report << dec << setfill(' ') << setw(17) << pc.second << setw(9) << fixed << setprecision(2) << 100.0 * pc.second / total << "\n";
+  }
+
+  report << "\nHot spots by basic block\n";
+  report << "     start         end  instructions      executions        %\n";
+  for(auto &block : blocks) {
+    report << "0x" << hex << setw(8) << setfill('0') << block.start << "  0x" << setw(8) << block.start + 4 * (block.length - 1);
+    report << dec << setfill(' ') << setw(14) << block.length << setw(16) << block.count;
+    report << setw(9) << fixed << setprecision(2) << 100.0 * block.count * block.length / total << "\n";
+  }
+
+  for(uint32_t node = 0; node < stacks.size(); node++) {
+    if(stacks[node].instructions) folded << stackName(node) << " " << dec << stacks[node].instructions << "\n";
+  }
+
+  return true;
+}
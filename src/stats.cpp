@@ -0,0 +1,83 @@
+#include "./../inc/emulator.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <csignal>
+#include <cstdio>
+#include <pthread.h>
+
+// index 0 is instructionCount, the others are counters, other cores may still be running during a report
+uint64_t Emulator::counterValue(uint32_t index) {
+  if(index == 0) return __atomic_load_n(&instructionCount, __ATOMIC_RELAXED);
+  return __atomic_load_n(&counters[index - 1], __ATOMIC_RELAXED);
+}
+
+// a read of the low word latches the whole counter, the high word read after it belongs to the same value
+uint32_t Emulator::counterRead(uint32_t address) {
+  if(address < COUNTERS_START || (address & 3)) return 0;
+  uint32_t offset = address - COUNTERS_START;
+  if(offset & 4) return static_cast<uint32_t>(latchedCounter >> 32);
+  latchedCounter = counterValue(offset / 8);
+  return static_cast<uint32_t>(latchedCounter);
+}
+
+// Called by core 0 between two instructions, the report is written next to the file and renamed over it
+// so that a reader never sees half of one
+bool Emulator::writeStats(bool running) {
+  static const char *counterNames[OPCODES] = {"memoryReads", "memoryWrites", "mmioReads", "mmioWrites", "timerInterrupts", "terminalInterrupts", "softwareInterrupts", "dmaInterrupts"};
+  static const char *opcodeNames[OPCODE_GROUPS] = {"halt", "int", "call", "jmp", "xchg", "arithmetic", "logic", "shift", "st", "ld", "unknown"};
+
+  uint64_t total = 0;
+  for(uint32_t id = 0; id <= cores.size(); id++) total += core(id)->counterValue(0);
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - runStart;
+
+  string temporary = options.stats + ".tmp";
+  ofstream file(temporary);
+  if(!file.is_open()) return false;
+
+  file << "{\n";
+  file << "  \"running\": " << (running ? "true" : "false") << ",\n";
+  file << "  \"seconds\": " << fixed << setprecision(6) << elapsed.count() << ",\n";
+  file << "  \"instructions\": " << total << ",\n";
+  file << "  \"mips\": " << setprecision(2) << (elapsed.count() > 0 ? total / elapsed.count() / 1e6 : 0) << ",\n";
+  file << "  \"cores\": [\n";
+  for(uint32_t id = 0; id <= cores.size(); id++) {
+    Emulator *emulator = core(id);
+    file << "    {\n";
+    file << "      \"core\": " << id << ",\n";
+    file << "      \"instructions\": " << emulator->counterValue(0) << ",\n";
+    for(uint32_t i = 0; i < OPCODES; i++) file << "      \"" << counterNames[i] << "\": " << emulator->counterValue(1 + i) << ",\n";
+    file << "      \"opcodes\": {";
+    for(uint32_t i = 0; i < OPCODE_GROUPS; i++) file << (i ? ", " : "") << "\"" << opcodeNames[i] << "\": " << emulator->counterValue(1 + OPCODES + i);
+    file << "}\n";
+    file << "    }" << (id < cores.size() ? "," : "") << "\n";
+  }
+  file << "  ]\n";
+  file << "}\n";
+
+  file.close();
+  return file.good() && rename(temporary.c_str(), options.stats.c_str()) == 0;
+}
+
+// SIGUSR1 is blocked before any other thread starts, threads inherit the mask so that only the statistics
+// thread takes it
+void Emulator::blockStatsSignal() {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+void Emulator::startStatsSignal() {
+  statsThread = thread(&Emulator::emulatingStatsSignal, this);
+}
+
+// the destructor sends the last signal to end the thread
+void Emulator::emulatingStatsSignal() {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+
+  int signal;
+  while(sigwait(&signals, &signal) == 0 && !end) postInterrupt(STATS_REQUEST);
+}
@@ -0,0 +1,163 @@
+#include "./../inc/trace.hpp"
+
+#include <chrono>
+#include <algorithm>
+
+static const char TRACE_MAGIC[8] = {'E', 'M', 'U', 'T', 'R', 'C', 'E', '1'};
+
+Tracer::Tracer(const string &fileName) : ring(RING_SIZE), file(fileName, ios::binary) {
+  if(!file.is_open()) return;
+  file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  writerThread = thread(&Tracer::writer, this);
+}
+
+Tracer::~Tracer() {
+  finish();
+}
+
+bool Tracer::finish() {
+  finished = true;
+  if(writerThread.joinable()) writerThread.join();
+  if(file.is_open()) file.close();
+  return !failed;
+}
+
+// the processor only waits when the writer falls a whole ring behind
+void Tracer::waitForSpace() {
+  while(true) {
+    freeUntil = tail.load(memory_order_acquire) + RING_SIZE;
+    if(head.load(memory_order_relaxed) != freeUntil) return;
+    this_thread::yield();
+  }
+}
+
+static void putVarint(vector<uint8_t> &out, uint64_t value) {
+  while(value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+// small negative deltas become small numbers too
+static uint32_t zigzag(int32_t value) {
+  return static_cast<uint32_t>(value) << 1 ^ static_cast<uint32_t>(value >> 31);
+}
+
+static int32_t unzigzag(uint64_t value) {
+  return static_cast<int32_t>(static_cast<uint32_t>(value >> 1) ^ -static_cast<uint32_t>(value & 1));
+}
+
+void Tracer::writer() {
+  static const size_t FLUSH_SIZE = 64 << 10;
+  vector<uint8_t> out;
+  out.reserve(FLUSH_SIZE + 64);
+  vector<uint32_t> words(WORD_TABLE_SIZE, 0);
+  vector<uint32_t> addresses(WORD_TABLE_SIZE, 0);
+  vector<uint32_t> values(WORD_TABLE_SIZE, 0);
+  uint32_t pc = 0;
+
+  while(true) {
+    bool last = finished.load(memory_order_acquire);
+    uint64_t from = tail.load(memory_order_relaxed);
+    uint64_t to = head.load(memory_order_acquire);
+
+    for(uint64_t position = from; position < to; position++) {
+      const traceEvent &event = ring[position & (RING_SIZE - 1)];
+      if(event.kind == INSTRUCTION) {
+        uint32_t &known = words[wordSlot(event.first)];
+        uint8_t tag = INSTRUCTION;
+        if(event.first == pc + 4) tag |= NEXT_PC;
+        if(known == event.second) tag |= KNOWN_WORD;
+        out.push_back(tag);
+        if(!(tag & NEXT_PC)) putVarint(out, zigzag(event.first - pc));
+        if(!(tag & KNOWN_WORD)) {
+          for(int i = 0; i < 4; i++) out.push_back(static_cast<uint8_t>(event.second >> 8 * i));
+        }
+        known = event.second;
+        pc = event.first;
+      } else if(event.kind == STORE) {
+        uint32_t slot = wordSlot(pc);
+        out.push_back(STORE);
+        putVarint(out, zigzag(event.first - addresses[slot]));
+        putVarint(out, zigzag(event.second - values[slot]));
+        addresses[slot] = event.first;
+        values[slot] = event.second;
+      } else {
+        out.push_back(INTERRUPT);
+        putVarint(out, event.first);
+        putVarint(out, event.second);
+      }
+
+      if(out.size() >= FLUSH_SIZE) {
+        file.write(reinterpret_cast<const char *>(out.data()), out.size());
+        out.clear();
+      }
+    }
+    tail.store(to, memory_order_release);
+
+    // the events posted before finish was seen are all written by now
+    if(last) break;
+    if(from == to) this_thread::sleep_for(chrono::microseconds(200));
+  }
+
+  file.write(reinterpret_cast<const char *>(out.data()), out.size());
+  file.flush();
+  failed = !file.good();
+}
+
+TraceReader::TraceReader(const string &fileName) : file(fileName, ios::binary), words(Tracer::WORD_TABLE_SIZE, 0),
+    addresses(Tracer::WORD_TABLE_SIZE, 0), values(Tracer::WORD_TABLE_SIZE, 0) {
+  char magic[sizeof(TRACE_MAGIC)];
+  valid = file.read(magic, sizeof(magic)) && equal(magic, magic + sizeof(magic), TRACE_MAGIC);
+}
+
+bool TraceReader::readVarint(uint64_t &value) {
+  value = 0;
+  for(int shift = 0; shift < 64; shift += 7) {
+    int c = file.get();
+    if(c == EOF) return false;
+    value |= static_cast<uint64_t>(c & 0x7F) << shift;
+    if(!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+// false at the end of the file or at an event that was cut off
+bool TraceReader::next(Tracer::traceEvent &event) {
+  int tag = file.get();
+  if(!valid || tag == EOF) return false;
+
+  uint64_t first, second;
+  event.kind = tag & 0x3;
+  if(event.kind == Tracer::INSTRUCTION) {
+    if(tag & Tracer::NEXT_PC) {
+      pc += 4;
+    } else {
+      if(!readVarint(first)) return false;
+      pc += unzigzag(first);
+    }
+    uint32_t &known = words[Tracer::wordSlot(pc)];
+    if(!(tag & Tracer::KNOWN_WORD)) {
+      uint8_t bytes[4];
+      if(!file.read(reinterpret_cast<char *>(bytes), 4)) return false;
+      known = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+    }
+    event.first = pc;
+    event.second = known;
+  } else if(event.kind == Tracer::STORE) {
+    if(!readVarint(first) || !readVarint(second)) return false;
+    uint32_t slot = Tracer::wordSlot(pc);
+    addresses[slot] += unzigzag(first);
+    values[slot] += unzigzag(second);
+    event.first = addresses[slot];
+    event.second = values[slot];
+  } else if(event.kind == Tracer::INTERRUPT) {
+    if(!readVarint(first) || !readVarint(second)) return false;
+    event.first = first;
+    event.second = second;
+  } else {
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,21 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+my_start:
+    ld $initial_sp, %sp
+    # the value every run finds, a write of an earlier run of the image must not show
+    ld shared, %r1
+    ld $1, %r2
+    add %r1, %r2
+    st %r2, shared
+    ld shared, %r3
+    halt
+
+.section my_data
+shared:
+.word 0x1234
+
+.end
@@ -0,0 +1,15 @@
+# file: reader.s
+
+.global my_start
+
+.section code
+my_start:
+    # the word main.s writes, at the same address in this image
+    ld shared, %r1
+    halt
+
+.section my_data
+shared:
+.word 0x1234
+
+.end
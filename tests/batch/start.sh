@@ -0,0 +1,21 @@
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+EMULATOR=./../../build/emulator
+
+${ASSEMBLER} -o main.o main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -place=my_data@0x50000000 \
+  -o main.hex \
+  main.o
+${ASSEMBLER} -o reader.o reader.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -place=my_data@0x50000000 \
+  -o reader.hex \
+  reader.o
+
+# the runs of an image map the same checkpoint copy on write, every run of main.hex has r1=0x00001234
+# and r3=0x00001235, every run of reader.hex r1=0x00001234, one after another and in parallel
+${EMULATOR} -batch=images.txt -threads=1 | grep -e "^==" -e "r0=" | sed "s/ (.*//"
+${EMULATOR} -batch=images.txt -threads=3 | grep -e "^==" -e "r0=" | sed "s/ (.*//"
@@ -0,0 +1,28 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+.equ iterations, 3000000
+my_start:
+    ld $initial_sp, %sp
+    ld $0, %r1
+    ld $iterations, %r2
+    ld $1, %r3
+    ld $buffer, %r4
+loop:
+    add %r3, %r1
+    st %r1, [%r4]
+    ld [%r4], %r5
+    push %r5
+    pop %r6
+    xor %r5, %r6
+    bne %r1, %r2, loop
+    halt
+
+.section my_data
+buffer:
+.word 0
+
+.end
@@ -0,0 +1,39 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+my_start:
+    ld $initial_sp, %sp
+
+    # two passes over 4 KiB of words, the second one hits only in a data cache of 4 KiB or more
+    ld $2, %r5
+pass:
+    ld $table, %r1
+    ld $4096, %r2
+    add %r1, %r2
+    ld $4, %r3
+sum:
+    ld [%r1 + 0], %r4
+    add %r4, %r6
+    add %r3, %r1
+    bne %r1, %r2, sum
+    ld $1, %r4
+    sub %r4, %r5
+    bne %r5, %r0, pass
+
+    # every store to the stride hits a new line
+    ld $table, %r1
+    ld $64, %r3
+store:
+    st %r6, [%r1 + 0]
+    add %r3, %r1
+    bne %r1, %r2, store
+    halt
+
+.section my_data
+table:
+.skip 4096
+
+.end
@@ -0,0 +1,14 @@
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+EMULATOR=./../../build/emulator
+
+${ASSEMBLER} -o main.o main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -place=my_data@0x50000000 \
+  -o program.hex \
+  main.o
+${EMULATOR} -icache=256:16:1 -dcache=1024:16:2 -cache-report=program.txt program.hex
+cat program.txt
+${EMULATOR} -dcache=8192:32:4 -cache-report=program.txt program.hex
+cat program.txt
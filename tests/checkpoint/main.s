@@ -0,0 +1,55 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+.equ term_out, 0xFFFFFF00
+.equ tim_cfg, 0xFFFFFF10
+my_start:
+    ld $initial_sp, %sp
+    ld $handler, %r1
+    csrwr %r1, %handler
+    # a tick every 500 ms of virtual time
+    st %r0, tim_cfg
+    ld $0x30, %r1
+    ld $0x3A, %r2
+    ld $1, %r3
+# prints the digits on lines of their own, each after a loop that adds it and the counter to sum
+line:
+    ld $0, %r4
+    ld $2000, %r5
+mix:
+    ld sum, %r6
+    add %r4, %r6
+    add %r1, %r6
+    st %r6, sum
+    add %r3, %r4
+    bne %r4, %r5, mix
+    st %r1, term_out
+    ld $10, %r6
+    st %r6, term_out
+    add %r3, %r1
+    bne %r1, %r2, line
+    ld ticks, %r7
+    ld sum, %r8
+    halt
+
+handler:
+    push %r1
+    push %r2
+    ld ticks, %r1
+    ld $1, %r2
+    add %r2, %r1
+    st %r1, ticks
+    pop %r2
+    pop %r1
+    iret
+
+.section my_data
+ticks:
+.word 0
+sum:
+.word 0
+
+.end
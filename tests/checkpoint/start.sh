@@ -0,0 +1,25 @@
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+EMULATOR=./../../build/emulator
+
+${ASSEMBLER} -o main.o main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -place=my_data@0x50000000 \
+  -o program.hex \
+  main.o
+
+# a run restored from a checkpoint prints what the uninterrupted run printed after it, then the same state;
+# the timer runs in virtual time so that its ticks fall on the same instructions
+full=$(${EMULATOR} -virtual-time=10 program.hex)
+echo "$full"
+for engine in switch threaded jit; do
+  ${EMULATOR} -engine=${engine} -virtual-time=10 -save=program.ckpt@50003 program.hex > /dev/null
+  restored=$(${EMULATOR} -engine=${engine} -virtual-time=10 -restore=program.ckpt)
+  if [ -n "$restored" ] && [ "${full%"$restored"}" != "$full" ]; then
+    echo "${engine}: the restored run matches"
+  else
+    echo "${engine}: the restored run differs"
+    echo "$restored"
+  fi
+done
@@ -0,0 +1,40 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+.equ iterations, 1000000
+my_start:
+    csrrd %coreid, %r1
+    ld $0, %r2
+    beq %r1, %r2, core0
+    ld $iterations, %r2
+    ld $0, %r3
+    ld $1, %r4
+sum:
+    add %r2, %r3
+    sub %r4, %r2
+    bne %r2, %r0, sum
+    ld $result, %r5
+    st %r3, [%r5]
+    ld $done, %r5
+    st %r4, [%r5]
+    halt
+core0:
+    ld $initial_sp, %sp
+    ld $done, %r5
+wait:
+    ld [%r5], %r6
+    beq %r6, %r0, wait
+    ld $result, %r5
+    ld [%r5], %r1
+    halt
+
+.section my_data
+result:
+.word 0
+done:
+.word 0
+
+.end
@@ -0,0 +1,11 @@
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+EMULATOR=./../../build/emulator
+
+${ASSEMBLER} -o main.o main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -o program.hex \
+  main.o
+${EMULATOR} -cores=2 -mips program.hex
+${EMULATOR} -cores=2 -engine=threaded -mips program.hex
@@ -0,0 +1,40 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+.equ iterations, 1000000
+my_start:
+    ld $initial_sp, %sp
+    ld $0, %r1
+    ld $iterations, %r2
+    ld $1, %r3
+    ld $buffer, %r4
+    ld $3, %r5
+loop:
+    add %r3, %r1
+    ld %r1, %r6
+    sub %r3, %r6
+    mul %r5, %r6
+    or %r1, %r6
+    and %r5, %r6
+    xor %r6, %r7
+    shl %r3, %r7
+    shr %r3, %r7
+    not %r8
+    xchg %r7, %r8
+    st %r6, [%r4]
+    ld [%r4 + 0], %r9
+    push %r9
+    pop %r10
+    csrrd %status, %r11
+    add %r3, %r0
+    bne %r1, %r2, loop
+    halt
+
+.section my_data
+buffer:
+.word 0
+
+.end
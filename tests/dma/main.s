@@ -0,0 +1,96 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+.equ dma_src, 0xFFFFFF30
+.equ dma_dst, 0xFFFFFF34
+.equ dma_len, 0xFFFFFF38
+.equ dma_ctrl, 0xFFFFFF3C
+.equ run_fill, 0x3
+.equ run_interrupt, 0x5
+.equ run, 0x1
+my_start:
+    ld $initial_sp, %sp
+    ld $handler, %r1
+    csrwr %r1, %handler
+
+    # a page filled with 0xAB and zero filled again, start.sh saves a checkpoint in the delay loop in between
+    ld $0xAB, %r1
+    st %r1, dma_src
+    ld $0x50004000, %r1
+    st %r1, dma_dst
+    ld $4096, %r1
+    st %r1, dma_len
+    ld $run_fill, %r1
+    st %r1, dma_ctrl
+    ld $0, %r11
+    ld $1000, %r12
+    ld $1, %r13
+delay:
+    add %r13, %r11
+    bne %r11, %r12, delay
+    st %r0, dma_src
+    ld $run_fill, %r1
+    st %r1, dma_ctrl
+    ld 0x50004000, %r11
+    ld 0x50004ffc, %r12
+
+    # fill a page with 0x5A, control reads back as fill and done
+    ld $0x5A, %r1
+    st %r1, dma_src
+    ld $0x50001000, %r1
+    st %r1, dma_dst
+    ld $4096, %r1
+    st %r1, dma_len
+    ld $run_fill, %r1
+    st %r1, dma_ctrl
+    ld dma_ctrl, %r6
+
+    # copy it to an unaligned address and wait for the interrupt
+    ld $0x50001000, %r1
+    st %r1, dma_src
+    ld $0x50002002, %r1
+    st %r1, dma_dst
+    ld $run_interrupt, %r1
+    st %r1, dma_ctrl
+wait:
+    ld done, %r2
+    beq %r2, %r0, wait
+    ld 0x50002002, %r7
+    ld 0x50003000, %r8
+
+    # overlapping copy one word up, like memmove
+    ld $words, %r1
+    st %r1, dma_src
+    ld $4, %r3
+    add %r3, %r1
+    st %r1, dma_dst
+    ld $12, %r1
+    st %r1, dma_len
+    ld $run, %r1
+    st %r1, dma_ctrl
+    ld $words, %r1
+    ld [%r1 + 4], %r9
+    ld [%r1 + 12], %r10
+    halt
+
+# keeps the cause of the interrupt
+handler:
+    push %r1
+    csrrd %cause, %r1
+    st %r1, done
+    pop %r1
+    iret
+
+.section my_data
+words:
+.word 1
+.word 2
+.word 3
+.word 4
+done:
+.word 0
+
+.end
@@ -0,0 +1,16 @@
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+EMULATOR=./../../build/emulator
+
+${ASSEMBLER} -o main.o main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -place=my_data@0x50000000 \
+  -o program.hex \
+  main.o
+${EMULATOR} program.hex
+${EMULATOR} -engine=jit program.hex
+
+# the zero fill after a restore replaces pages that are mapped from the checkpoint
+${EMULATOR} -save=program.ckpt@500 program.hex > /dev/null
+${EMULATOR} -restore=program.ckpt
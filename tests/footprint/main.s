@@ -0,0 +1,32 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+my_start:
+    ld $initial_sp, %sp
+    ld $0, %r1
+    ld $4, %r2
+    ld $buffer, %r3
+    ld $4096, %r4
+# one word in each of four pages of the buffer
+loop:
+    call far_function
+    st %r1, [%r3]
+    add %r4, %r3
+    bne %r1, %r2, loop
+    halt
+
+# placed near the top of the address space, far from the rest
+.section far
+far_function:
+    ld $1, %r5
+    add %r5, %r1
+    ret
+
+.section my_data
+buffer:
+.word 0
+
+.end
@@ -0,0 +1,12 @@
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+EMULATOR=./../../build/emulator
+
+${ASSEMBLER} -o main.o main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -place=far@0xF0000000 \
+  -place=my_data@0x80000000 \
+  -o program.hex \
+  main.o
+${EMULATOR} -footprint program.hex
@@ -0,0 +1,26 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+.equ iterations, 2000000
+my_start:
+    ld $initial_sp, %sp
+    ld $0, %r1
+    ld $iterations, %r2
+loop:
+    ld $1, %r3
+    add %r3, %r1
+    ld $0x12345678, %r4
+    ld $result, %r5
+    st %r1, result
+    ld result, %r6
+    bne %r1, %r2, loop
+    halt
+
+.section my_data
+result:
+.word 0
+
+.end
@@ -0,0 +1,14 @@
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+EMULATOR=./../../build/emulator
+
+${ASSEMBLER} -o main.o main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -place=my_data@0x50000000 \
+  -o program.hex \
+  main.o
+${EMULATOR} -engine=switch -mips program.hex
+${EMULATOR} -engine=switch -no-fusion -mips program.hex
+${EMULATOR} -engine=threaded -mips program.hex
+${EMULATOR} -engine=threaded -no-fusion -mips program.hex
@@ -0,0 +1,29 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+.equ iterations, 3
+my_start:
+    ld $initial_sp, %sp
+    ld $0, %r1
+    ld $iterations, %r2
+loop:
+    call increment
+    bne %r1, %r2, loop
+    halt
+
+# placed on its own so that the test knows where to put the breakpoint
+.section function
+increment:
+    ld $1, %r3
+    add %r3, %r1
+    st %r1, counter
+    ret
+
+.section my_data
+counter:
+.word 0
+
+.end
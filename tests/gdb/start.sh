@@ -0,0 +1,48 @@
+#!/bin/bash
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+EMULATOR=./../../build/emulator
+PORT=1234
+
+${ASSEMBLER} -o main.o main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -place=function@0x40001000 \
+  -place=my_data@0x50000000 \
+  -o program.hex \
+  main.o
+${EMULATOR} -gdb=${PORT} program.hex < /dev/null &
+
+# a small gdb over bash's /dev/tcp, every packet is printed with its reply
+for i in $(seq 50); do
+  exec 3<> /dev/tcp/127.0.0.1/${PORT} && break
+  sleep 0.1
+done 2> /dev/null
+
+packet() {
+  local sum=0
+  for ((i = 0; i < ${#1}; i++)); do
+    sum=$(( (sum + $(printf '%d' "'${1:i:1}")) % 256 ))
+  done
+  printf '$%s#%02x' "$1" ${sum} >&3
+  local reply
+  read -r -d '#' -u 3 reply
+  read -r -n 2 -u 3
+  echo "$1 -> ${reply##*$}"
+}
+
+packet "QStartNoAckMode"
+packet "?"
+packet "Z0,40001000,4"
+packet "c"
+packet "pf"
+packet "s"
+packet "pf"
+packet "z0,40001000,4"
+packet "Z2,50000000,4"
+packet "c"
+packet "m50000000,4"
+packet "z2,50000000,4"
+packet "c"
+exec 3<&-
+wait
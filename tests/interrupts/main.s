@@ -0,0 +1,70 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+.equ dma_src, 0xFFFFFF30
+.equ dma_dst, 0xFFFFFF34
+.equ dma_len, 0xFFFFFF38
+.equ dma_ctrl, 0xFFFFFF3C
+.equ run_fill_interrupt, 0x7
+my_start:
+    ld $initial_sp, %sp
+    ld $handler, %r1
+    csrwr %r1, %handler
+
+    # the handler posts two more requests while status masks them, both are taken after its iret:
+    # first the software one, then the DMA one once the second handler returns
+    int
+    ld $log, %r1
+    ld [%r1 + 0], %r2
+    ld [%r1 + 4], %r3
+    ld [%r1 + 8], %r4
+    ld [%r1 + 12], %r6
+    ld scratch, %r5
+    halt
+
+# appends the cause to the log, the first time it also fills scratch with an interrupt at the end and runs int
+handler:
+    push %r1
+    push %r2
+    csrrd %cause, %r1
+    ld next, %r2
+    st %r1, [%r2]
+    ld $4, %r1
+    add %r1, %r2
+    st %r2, next
+
+    ld first, %r1
+    beq %r1, %r0, leave
+    st %r0, first
+    ld $0x77, %r1
+    st %r1, dma_src
+    ld $scratch, %r1
+    st %r1, dma_dst
+    ld $4, %r1
+    st %r1, dma_len
+    ld $run_fill_interrupt, %r1
+    st %r1, dma_ctrl
+    int
+leave:
+    pop %r2
+    pop %r1
+    # an interrupt between the restore of status and the pop of pc would return to the pop forever
+    iret
+
+.section my_data
+first:
+.word 1
+next:
+.word log
+log:
+.word 0
+.word 0
+.word 0
+.word 0
+scratch:
+.word 0
+
+.end
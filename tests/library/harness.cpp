@@ -0,0 +1,80 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "./../../inc/embeddedEmulator.hpp"
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool condition, const string &what) {
+  if(!condition) {
+    cout << "FAILED: " << what << endl;
+    failures++;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  ifstream file(argc > 1 ? argv[1] : "program.hex");
+  stringstream image;
+  image << file.rdbuf();
+
+  // the image is loaded from memory for every scenario
+  const int SCENARIOS = 1000;
+  for(int i = 0; i < SCENARIOS; i++) {
+    EmbeddedEmulator emulator;
+    check(emulator.loadHex(image.str()), "load");
+    check(emulator.run(10000) == EmbeddedEmulator::IDLE, "idle without input");
+
+    // one character at a time, the guest is idle again before the next one
+    string input = "s" + to_string(i);
+    for(char c : input) {
+      check(emulator.typeInput(string(1, c)) == 1, "input queued");
+      check(emulator.run(10000) == EmbeddedEmulator::IDLE, "idle after the input");
+    }
+    check(emulator.output() == input, "echo");
+    check(emulator.read32(0x50000000) == input.size(), "counted");
+  }
+
+  EmbeddedEmulator emulator;
+  emulator.loadHex(image.str());
+  check(emulator.run(2) == EmbeddedEmulator::BUDGET_USED && emulator.instructions() == 2, "bounded run");
+  check(emulator.run(10000) == EmbeddedEmulator::IDLE, "idle after the bounded run");
+  emulator.typeInput("x");
+  check(emulator.runUntil([](EmbeddedEmulator &e) { return e.csr(2) == 3; }, 10000) == EmbeddedEmulator::CONDITION_MET, "run until the terminal interrupt");
+  emulator.write32(0x50000000, 41);
+  emulator.run(10000);
+  check(emulator.read32(0x50000000) == 42 && emulator.output() == "x", "state written by the host");
+  check(!emulator.setCsr(3, 5) && emulator.csr(3) == 0, "coreid refused");
+  check(!emulator.setCsr(16, 0) && !emulator.setCsr(-1, 0), "csr index out of range refused");
+  check(emulator.csr(16) == 0 && emulator.gpr(16) == 0 && emulator.gpr(-1) == 0, "register index out of range read as 0");
+  check(!emulator.setGpr(0, 1) && !emulator.setGpr(16, 1) && !emulator.setGpr(-1, 1) && emulator.gpr(0) == 0, "gpr writes refused");
+  check(emulator.setGpr(7, 0x1234) && emulator.gpr(7) == 0x1234, "gpr written by the host");
+  check(emulator.setCsr(1, 0x40000000) && emulator.csr(1) == 0x40000000, "handler written by the host");
+  check(emulator.setCsr(9, 0xcafe) && emulator.saveCheckpoint("harness.ckpt"), "checkpoint saved");
+  EmbeddedEmulator restored;
+  check(restored.loadCheckpoint("harness.ckpt") && restored.csr(9) == 0xcafe && restored.csr(1) == 0x40000000, "csrs restored");
+  remove("harness.ckpt");
+
+  // a bounded run stops at its limit with every engine, also in the middle of a translated block
+  for(engineType engine : {SWITCH_ENGINE, THREADED_ENGINE, JIT_ENGINE}) {
+    emulatorOptions options = EmbeddedEmulator::defaultOptions();
+    options.engine = engine;
+    EmbeddedEmulator bounded(options);
+    bounded.loadHex(image.str());
+    check(bounded.run(2) == EmbeddedEmulator::BUDGET_USED && bounded.instructions() == 2, "first bounded run, engine " + to_string(engine));
+    check(bounded.run(5) == EmbeddedEmulator::BUDGET_USED && bounded.instructions() == 7, "second bounded run, engine " + to_string(engine));
+  }
+
+  uint32_t written = 0;
+  EmbeddedEmulator withDevice;
+  withDevice.loadHex(image.str());
+  check(withDevice.addDevice("answer", 0xFFFFFF20, 0xFFFFFF27, [](uint32_t) { return 41u; }, [&written](uint32_t, uint32_t value) { written = value; }), "device added");
+  check(!withDevice.addDevice("overlap", 0xFFFFFF00, 0xFFFFFF03, nullptr, nullptr), "overlapping device refused");
+  withDevice.run(10000);
+  check(written == 41 && withDevice.read32(0xFFFFFF24) == 0, "device callbacks");
+
+  cout << (failures ? "Library tests failed" : "Library tests passed") << " (" << SCENARIOS << " scenarios)" << endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+my_start:
+    ld $initial_sp, %sp
+    ld $handler, %r1
+    csrwr %r1, %handler
+    ld 0xFFFFFF20, %r1 # device of the harness
+    st %r1, 0xFFFFFF24
+wait:
+    jmp wait
+
+# every character of the terminal is echoed and counted
+handler:
+    push %r1
+    ld 0xFFFFFF04, %r1 # term_in
+    st %r1, 0xFFFFFF00 # term_out
+    ld 0x50000000, %r1
+    push %r2
+    ld $1, %r2
+    add %r2, %r1
+    pop %r2
+    st %r1, 0x50000000
+    pop %r1
+    iret
+
+.end
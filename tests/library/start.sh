@@ -0,0 +1,10 @@
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+
+${ASSEMBLER} -o main.o main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -o program.hex \
+  main.o
+g++ -O2 -pthread harness.cpp ./../../build/libemulator.a -o harness
+./harness program.hex
@@ -0,0 +1,14 @@
+EMULATOR=./../../build/emulator
+MEGABYTES=${1:-32}
+
+# halt at the start address followed by MEGABYTES of data at 0x10000000
+awk -v lines=$((MEGABYTES * 131072)) 'BEGIN {
+  printf "40000000: 00 00 00 00 00 00 00 00 \n"
+  for(i = 0; i < lines; i++) {
+    printf "%08x:", 0x10000000 + i * 8
+    for(j = 0; j < 8; j++) printf " %02x", (i + j * 31) % 256
+    printf " \n"
+  }
+}' > image.hex
+
+${EMULATOR} -mips image.hex
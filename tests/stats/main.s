@@ -0,0 +1,40 @@
+# file: main.s
+
+.global my_start
+
+.section code
+.equ initial_sp, 0xFFFFFEFE
+.equ instructions, 0xFFFFFF40
+.equ memory_reads, 0xFFFFFF48
+.equ software_interrupts, 0xFFFFFF78
+.equ st_opcodes, 0xFFFFFFC8
+my_start:
+    ld $initial_sp, %sp
+    ld $handler, %r1
+    csrwr %r1, %handler
+    int
+    int
+    ld $buffer, %r4
+    ld $0, %r2
+    ld $100, %r3
+loop:
+    st %r2, [%r4]
+    ld [%r4], %r5
+    ld $1, %r5
+    add %r5, %r2
+    bne %r2, %r3, loop
+    ld instructions, %r6
+    ld 0xFFFFFF44, %r7
+    ld memory_reads, %r8
+    ld software_interrupts, %r9
+    ld st_opcodes, %r10
+    halt
+
+handler:
+    iret
+
+.section my_data
+buffer:
+.word 0
+
+.end
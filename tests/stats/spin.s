@@ -0,0 +1,13 @@
+# file: spin.s
+
+.global my_start
+
+.section code
+my_start:
+    ld $0, %r1
+    ld $1, %r2
+loop:
+    add %r2, %r1
+    jmp loop
+
+.end
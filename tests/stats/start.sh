@@ -0,0 +1,26 @@
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+EMULATOR=./../../build/emulator
+
+${ASSEMBLER} -o main.o main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -place=my_data@0x50000000 \
+  -o program.hex \
+  main.o
+${EMULATOR} -stats=program.json program.hex
+cat program.json
+${EMULATOR} -engine=threaded program.hex
+
+# a report asked for with SIGUSR1 while a trace is written
+${ASSEMBLER} -o spin.o spin.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -o spin.hex \
+  spin.o
+${EMULATOR} -trace=spin.trace -stats=spin.json -limit=50000000 spin.hex < /dev/null &
+sleep 0.5
+kill -USR1 $!
+wait $!
+echo "exit code $?"
+grep running spin.json
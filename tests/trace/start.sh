@@ -0,0 +1,15 @@
+ASSEMBLER=./../../build/assembler
+LINKER=./../../build/linker
+EMULATOR=./../../build/emulator
+TRACEDECODER=./../../build/tracedecoder
+
+${ASSEMBLER} -o main.o ./../benchmark/main.s
+${LINKER} -hex \
+  -place=code@0x40000000 \
+  -place=my_data@0x50000000 \
+  -o program.hex \
+  main.o
+${EMULATOR} -mips program.hex
+${EMULATOR} -mips -trace=program.trace program.hex
+${TRACEDECODER} program.trace | tail -20
+${TRACEDECODER} -csv program.trace > program.csv